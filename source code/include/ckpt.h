@@ -0,0 +1,47 @@
+#ifndef CKPT_H
+#define CKPT_H
+
+#include "common.h"
+#include <stdio.h>
+
+/*
+ *  Checkpoint of the whole simulator, taken at a time slot boundary. The
+ *  file is a ckpt_header_t then the sections written by os.c, every
+ *  field in host byte order: it is only meant to be read back by the
+ *  same build of the simulator.
+ */
+#define CKPT_MAGIC	0x4b43534f	// "OSCK" when read back on the host
+#define CKPT_VERSION	7
+
+struct ckpt_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t slot;		// Time the checkpoint was taken at
+	uint32_t num_cpus;
+	uint32_t avail_pid;	// Next PID the loader gives
+	uint64_t handed;	// Process lines of the config consumed
+};
+
+/* Raw fields. ckpt_get() exits on a short read, a restore cannot go on
+ * with half a state */
+void ckpt_put(FILE * f, const void * buf, size_t len);
+void ckpt_get(FILE * f, void * buf, size_t len);
+
+/* A length-prefixed string, ckpt_get_str() returns a malloc'ed copy */
+void ckpt_put_str(FILE * f, const char * s);
+char * ckpt_get_str(FILE * f);
+
+/* A process with its code path and its whole memory map. The process
+ * read back has its own mm but no memory device set */
+void ckpt_put_proc(FILE * f, struct pcb_t * proc);
+struct pcb_t * ckpt_get_proc(FILE * f);
+
+#ifdef MM_PAGING
+/* Storage and free frames of a memory device. Only the pages holding a
+ * nonzero byte are written. [mp] is read back over a device set up
+ * with the same size */
+void ckpt_put_memphy(FILE * f, struct memphy_struct * mp);
+void ckpt_get_memphy(FILE * f, struct memphy_struct * mp);
+#endif
+
+#endif
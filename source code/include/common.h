@@ -3,6 +3,7 @@
 
 /* Define structs and routine could be used by every source files */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef OSCFG_H
@@ -28,7 +29,9 @@ enum ins_opcode_t {
 	ALLOC,	// Allocate memory
 	FREE,	// Deallocated a memory block
 	READ,	// Write data to a byte on memory
-	WRITE	// Read data from a byte on memory
+	WRITE,	// Read data from a byte on memory
+	COPY,	// Copy bytes from a memory region to another
+	FILL	// Set bytes of a memory region to a value
 };
 
 /* instructions executed by the CPU */
@@ -39,9 +42,15 @@ struct inst_t {
 	uint32_t arg_2;
 };
 
+struct dinst_t;
+
 struct code_seg_t {
 	struct inst_t * text;
 	uint32_t size;
+	struct dinst_t * ops;	// Pre-decoded [text], see predecode()
+	void * image;		// Mapping [text] lives in, NULL if malloc'ed
+	size_t image_len;
+	int refcnt;		// Processes sharing it, see release_code()
 };
 
 struct trans_table_t {
@@ -74,6 +83,9 @@ struct pcb_t {
 	// Priority on execution (if supported), on-fly aka. changeable
 	// and this vale overwrites the default priority when it existed
 	uint32_t prio;     
+	int cpu;	// CPU which dispatched this process last, -1 if none
+	uint64_t vruntime; // Weighted virtual runtime (CFS policy)
+	uint32_t slice;	   // Slots used since the last dispatch
 #endif
 #ifdef CPU_TLB
 	struct memphy_struct *tlb;
@@ -86,6 +98,13 @@ struct pcb_t {
 #endif
 	struct page_table_t * page_table; // Page table
 	uint32_t bp;	// Break pointer
+	/* Accounting, in time slots (see stats.h) */
+	uint64_t arrival;	// Handed to the scheduler
+	uint64_t first_dispatch; // First put on a CPU
+	uint64_t ready_since;	// Last entered a run queue
+	uint64_t wait_time;	// Total time spent in run queues
+	uint64_t run_time;	// Total time spent on a CPU
+	uint64_t finish;	// Last instruction retired
 
 };
 
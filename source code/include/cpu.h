@@ -1,13 +1,33 @@
-
 #ifndef CPU_H
 #define CPU_H
 
 #include "common.h"
 
+/* Handler of a pre-decoded instruction, bound to the memory backend
+ * (CPU_TLB, MM_PAGING or the legacy one) when the code is decoded */
+typedef int (*op_handler_t)(struct pcb_t * proc,
+		uint32_t arg_0, uint32_t arg_1, uint32_t arg_2);
+
+struct dinst_t {
+	op_handler_t handler;	// NULL for CALC, nothing to call
+	uint32_t arg_0;
+	uint32_t arg_1;
+	uint32_t arg_2;
+	enum ins_opcode_t opcode;
+};
+
 /* Execute an instruction of a process. Return 0
  * if the instruction is executed successfully.
  * Otherwise, return 1. */
 int run(struct pcb_t * proc);
 
-#endif
+/* Build the pre-decoded form of [code] if it does not have one yet.
+ * Safe to call from several threads on a shared segment. Return 0 on
+ * success, -1 if out of memory */
+int predecode(struct code_seg_t * code);
+
+/* Execute up to [n] instructions of [proc] from its pre-decoded code,
+ * stopping early at the end of the code. Return the number executed */
+int run_slice(struct pcb_t * proc, int n);
 
+#endif
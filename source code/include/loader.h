@@ -3,7 +3,31 @@
 
 #include "common.h"
 
+/*
+ *  Binary process image, the loadable form of a process description:
+ *  an img_header_t followed by [size] packed inst_t, in host byte
+ *  order. load() maps it in place instead of parsing it.
+ */
+#define IMG_MAGIC	0x474d4950	// "PIMG" when read back on the host
+#define IMG_VERSION	1
+
+struct img_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t priority;
+	uint32_t size;		// Number of instructions
+};
+
+/* Load the process described at [path], a binary image or the text
+ * format. Processes loaded from the same path share their code segment.
+ * The PID is left 0 for the caller to assign. Return NULL if it cannot be read or is malformed */
 struct pcb_t * load(const char * path);
 
-#endif
+/* Drop a reference to a code segment returned with load(), the last
+ * one frees it */
+void release_code(struct code_seg_t * code);
 
+/* Path [code] was loaded from */
+const char * code_path(struct code_seg_t * code);
+
+#endif
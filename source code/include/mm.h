@@ -2,6 +2,7 @@
 
 #include "bitops.h"
 #include "common.h"
+#include <stdio.h>
 
 /* CPU Bus definition */
 #define PAGING_CPU_BUS_WIDTH 22 /* 22bit bus - MAX SPACE 4MB */
@@ -11,14 +12,25 @@
 
 #define PAGING_MEMSWPSZ BIT(14) /* 16MB */
 #define PAGING_SWPFPN_OFFSET 5  
-#define PAGING_MAX_PGN  (DIV_ROUND_UP(BIT(PAGING_CPU_BUS_WIDTH),PAGING_PAGESZ))
+#define PAGING_MAX_PGN  BIT(PAGING_PGN_BITS)
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
+
+/* Radix page table, PAGING_PTBL_LEVELS levels of PAGING_PTBL_FANOUT slots
+ * indexed by bits of the PGN. Inner nodes and leaves of PTEs are only
+ * allocated when a page below them is first mapped */
+#define PAGING_PTBL_BITS 5
+#define PAGING_PTBL_FANOUT BIT(PAGING_PTBL_BITS)
+#define PAGING_PGN_BITS (PAGING_CPU_BUS_WIDTH - NBITS(PAGING_PAGESZ))
+#define PAGING_PTBL_LEVELS DIV_ROUND_UP(PAGING_PGN_BITS,PAGING_PTBL_BITS)
+#define PAGING_PTBL_IDX(pgn,lvl) \
+  (((pgn) >> ((lvl) * PAGING_PTBL_BITS)) & (PAGING_PTBL_FANOUT - 1))
 /* PTE BIT */
 #define PAGING_PTE_PRESENT_MASK BIT(31) 
 #define PAGING_PTE_SWAPPED_MASK BIT(30)
 #define PAGING_PTE_RESERVE_MASK BIT(29)
 #define PAGING_PTE_DIRTY_MASK BIT(28)
+#define PAGING_PTE_ACCESSED_MASK BIT(27)
 #define PAGING_PTE_EMPTY01_MASK BIT(14)
 #define PAGING_PTE_EMPTY02_MASK BIT(13)
 
@@ -26,10 +38,11 @@
 #define PAGING_PTE_SET_PRESENT(pte) (pte=pte|PAGING_PTE_PRESENT_MASK)
 #define PAGING_PAGE_PRESENT(pte) (pte&PAGING_PTE_PRESENT_MASK)
 #define PAGING_PAGE_DIRTY(pte) (pte&PAGING_PTE_DIRTY_MASK)
+#define PAGING_PAGE_SWAPPED(pte) (pte&PAGING_PTE_SWAPPED_MASK)
 
 /* USRNUM */
 #define PAGING_PTE_USRNUM_LOBIT 15
-#define PAGING_PTE_USRNUM_HIBIT 27
+#define PAGING_PTE_USRNUM_HIBIT 26
 /* FPN */
 #define PAGING_PTE_FPN_LOBIT 0
 #define PAGING_PTE_FPN_HIBIT 12
@@ -61,7 +74,6 @@
 /* SWAPFPN */
 #define PAGING_SWP_LOBIT NBITS(PAGING_PAGESZ)
 #define PAGING_SWP_HIBIT (NBITS(PAGING_MEMSWPSZ) - 1)
-#define PAGING_SWP(pte) ((pte&PAGING_SWP_MASK) >> PAGING_SWPFPN_OFFSET)
 
 /* Value operators */
 #define SETBIT(v,mask) (v=v|mask)
@@ -84,9 +96,9 @@
 /* Extract FramePHY Number*/
 #define PAGING_FPN(x)  GETVAL(x,PAGING_FPN_MASK,PAGING_PTE_FPN_LOBIT)
 /* Extract SWAPFPN */
-#define PAGING_PGN(x)  GETVAL(x,PAGING_PGN_MASK,PAGING_ADDR_PGN_LOBIT)
+#define PAGING_SWP(pte)  GETVAL(pte,PAGING_PTE_SWPOFF_MASK,PAGING_PTE_SWPOFF_LOBIT)
 /* Extract SWAPTYPE */
-#define PAGING_FPN(x)  GETVAL(x,PAGING_FPN_MASK,PAGING_PTE_FPN_LOBIT)
+#define PAGING_SWPTYP(pte)  GETVAL(pte,PAGING_PTE_SWPTYP_MASK,PAGING_PTE_SWPTYP_LOBIT)
 
 /* Memory range operator */
 #define INCLUDE(x1,x2,y1,y2) (((y1-x1)*(x2-y2)>=0)?1:0)
@@ -96,10 +108,7 @@
 struct vm_rg_struct * init_vm_rg(int rg_start, int rg_endi);
 int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode);
 int enlist_pgn_node(struct pgn_t **pgnlist, int pgn);
-int vmap_page_range(struct pcb_t *caller, int addr, int pgnum, 
-                    struct framephy_struct *frames, struct vm_rg_struct *ret_rg);
-int vm_map_ram(struct pcb_t *caller, int astart, int send, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg);
-int alloc_pages_range(struct pcb_t *caller, int incpgnum, struct framephy_struct **frm_lst);
+int vmap_page_reserve(struct pcb_t *caller, int addr, int pgnum);
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                 struct memphy_struct *mpdst, int dstfpn) ;
 int pte_set_fpn(uint32_t *pte, int fpn);
@@ -115,7 +124,63 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
 int __free(struct pcb_t *caller, int vmaid, int rgid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
+/* Translate page [pgn] of [caller] into the MEMRAM frame [fpn] */
+typedef int (*pg_translate_t)(struct pcb_t *caller, int pgn, int *fpn);
+int __copy(struct pcb_t *caller, int vmaid, int srcrg, int dstrg, int len,
+           pg_translate_t translate);
+int __fill(struct pcb_t *caller, int vmaid, int rgid, BYTE value, int len,
+           pg_translate_t translate);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
+/* Radix page table prototypes */
+typedef void (*pgtbl_fn_t)(int pgn, uint32_t *pte, void *arg);
+uint32_t *pgtbl_lookup(struct mm_struct *mm, int pgn);
+uint32_t pgtbl_get(struct mm_struct *mm, int pgn);
+int pgtbl_set(struct mm_struct *mm, int pgn, uint32_t pte);
+void pgtbl_walk(struct mm_struct *mm, int pgn_start, int pgn_end,
+                pgtbl_fn_t fn, void *arg);
+void pgtbl_free(struct mm_struct *mm);
+void free_mm(struct mm_struct *mm);
+/* Free region index prototypes */
+typedef void (*freerg_fn_t)(unsigned long rg_start, unsigned long rg_end, void *arg);
+void freerg_init(struct vm_freerg_tree *t);
+struct vm_freerg_node *freerg_lookup(struct vm_freerg_tree *t, unsigned long addr);
+int freerg_insert(struct vm_freerg_tree *t, unsigned long start, unsigned long end);
+int freerg_take(struct vm_freerg_tree *t, unsigned long size, struct vm_rg_struct *rg);
+void freerg_walk(struct vm_freerg_tree *t, freerg_fn_t fn, void *arg);
+void freerg_free(struct vm_freerg_tree *t);
+/* Page replacement prototypes */
+enum pgrepl_policy_t {
+  PGREPL_FIFO,
+  PGREPL_SECOND,
+  PGREPL_CLOCK,
+  PGREPL_LRU,
+  PGREPL_LFU,
+};
+int pgrepl_set_policy(const char *name);
+int pgrepl_init(int nframes);
+void pgrepl_add(struct pcb_t *owner, int pgn, int fpn, int swptyp, int swpfpn);
+void pgrepl_touch(struct mm_struct *mm, int pgn);
+int pgrepl_victim(struct pcb_t *caller, int *fpn);
+struct pcb_t *pgrepl_owner(int fpn, int *pgn);
+int pgrepl_get_swap(int fpn, int *swptyp, int *swpfpn);
+void pgrepl_del(int fpn);
+void pgrepl_evict(int fpn);
+void pgrepl_fault(int zerofill);
+void pgrepl_attach(struct pcb_t *proc);
+void pgrepl_save(FILE *f);
+void pgrepl_load(FILE *f);
+void pgrepl_report(void);
+/* Swap manager prototypes */
+int swap_set_prio(int swptyp, int prio);
+void swap_init(struct memphy_struct **mswp, int n);
+int swap_out(struct memphy_struct *mram, int fpn, int *swptyp, int *swpfpn);
+int swap_in(int swptyp, int swpfpn, struct memphy_struct *mram, int fpn);
+void swap_free(int swptyp, int swpfpn);
+void swap_skip(void);
+void swap_save(FILE *f);
+void swap_load(FILE *f);
+void swap_report(void);
+int free_pcb_memph(struct pcb_t *caller);
 
 /* CPUTLB prototypes */
 int tlb_change_all_page_tables_of(struct pcb_t *proc,  struct memphy_struct * mp);
@@ -124,6 +189,8 @@ int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
 int tlbfree_data(struct pcb_t *proc, uint32_t reg_index);
 int tlbread(struct pcb_t * proc, uint32_t source, uint32_t offset, uint32_t destination) ;
 int tlbwrite(struct pcb_t * proc, BYTE data, uint32_t destination, uint32_t offset);
+int tlbcopy(struct pcb_t * proc, uint32_t source, uint32_t destination, uint32_t len);
+int tlbfill(struct pcb_t * proc, uint32_t destination, BYTE data, uint32_t len);
 int init_tlbmemphy(struct memphy_struct *mp, int max_size);
 int TLBMEMPHY_read(struct memphy_struct * mp, int addr, BYTE *value);
 int TLBMEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
@@ -152,13 +219,28 @@ int pgwrite(
 		BYTE data, // Data to be wrttien into memory
 		uint32_t destination, // Index of destination register
 		uint32_t offset);
+int pgcopy(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t source, // Index of source register
+		uint32_t destination, // Index of destination register
+		uint32_t len);
+int pgfill(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t destination, // Index of destination register
+		BYTE data, // Data to be written into memory
+		uint32_t len);
 /* Local VM prototypes */
 int check_if_in_freerg_list(struct pcb_t *caller, int vmaid, struct vm_rg_struct *currg);
 struct vm_rg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend);
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz);
-int find_victim_page(struct mm_struct* mm, int *pgn);
+int find_victim_page(struct pcb_t *caller, int *fpn);
+int pg_evict(struct pcb_t *caller, int *fpn);
+void pg_setdirty(struct mm_struct *mm, int pgn);
+int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller);
+int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller);
+int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller);
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
 
 /* MEM/PHY protypes */
@@ -3,6 +3,7 @@
 
 #define MLQ_SCHED 1
 #define MAX_PRIO 140
+//#define SCHED_PERCPU_RQ //per-CPU run queues with work stealing
 
 //#define CPU_TLB //tlb
 //#define CPUTLB_FIXED_TLBSZ
@@ -25,6 +25,29 @@ struct vm_rg_struct {
    struct vm_rg_struct *rg_next;
 };
 
+/*
+ *  Free region, node of the two treaps of a vm_freerg_tree
+ */
+#define FREERG_BY_ADDR 0
+#define FREERG_BY_SIZE 1
+
+struct vm_freerg_node {
+   unsigned long rg_start;
+   unsigned long rg_end;
+
+   uint32_t prio;
+   struct vm_freerg_node *child[2][2]; /* [FREERG_BY_*][left, right] */
+};
+
+/*
+ *  Free regions of a vm area, see mm-freerg.c
+ */
+struct vm_freerg_tree {
+   struct vm_freerg_node *root[2]; /* [FREERG_BY_*] */
+   int count;
+   uint32_t seed;
+};
+
 /*
  *  Memory area struct
  */
@@ -39,7 +62,7 @@ struct vm_area_struct {
  * unsigned long vm_limit = vm_end - vm_start
  */
    struct mm_struct *vm_mm;
-   struct vm_rg_struct *vm_freerg_list;
+   struct vm_freerg_tree vm_freerg;
    struct vm_area_struct *vm_next;
 };
 
@@ -47,15 +70,13 @@ struct vm_area_struct {
  * Memory management struct
  */
 struct mm_struct {
-   uint32_t *pgd;
+   void *pgd; /* Root of the radix page table, see pgtbl_get() */
 
    struct vm_area_struct *mmap;
 
    /* Currently we support a fixed number of symbol */
    struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
 
-   /* list of free page */
-   struct pgn_t *fifo_pgn;
       sem_t memlock;
 };
 
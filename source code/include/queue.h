@@ -1,20 +1,62 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
+#include <stddef.h>
 #include "common.h"
 
-#define MAX_QUEUE_SIZE 10
+#define QUEUE_INIT_SIZE 16
 
+/* FIFO of processes kept in a ring buffer which grows on demand,
+ * a zero-filled queue_t is a valid empty queue */
 struct queue_t {
-	struct pcb_t * proc[MAX_QUEUE_SIZE];
-	int size;
+	struct pcb_t ** proc;
+	int head;	// Index of the oldest process in [proc]
+	int size;	// Number of processes in the queue
+	int cap;	// Number of slots allocated for [proc]
 	int curr_slot;
 };
 
-void enqueue(struct queue_t * q, struct pcb_t * proc);
+/* Append [proc] to [q]. Return 0 on success, -1 if [q] cannot grow */
+int enqueue(struct queue_t * q, struct pcb_t * proc);
 
 struct pcb_t * dequeue(struct queue_t * q);
 
 int empty(struct queue_t * q);
 
-#endif
\ No newline at end of file
+/* Release the storage of [q], the queued processes are not touched */
+void free_queue(struct queue_t * q);
+
+/* Bounded lock-free multi-producer/multi-consumer FIFO of processes.
+ * Every cell carries a sequence number telling whether it is ready to
+ * be written or read for the current lap, so producers and consumers
+ * only contend on their own position counter. */
+struct mpmc_cell_t {
+	size_t seq;
+	struct pcb_t * proc;
+};
+
+struct mpmc_queue_t {
+	struct mpmc_cell_t * cells;
+	size_t mask;
+	char pad0[64];
+	size_t enq_pos;
+	char pad1[64];
+	size_t deq_pos;
+	char pad2[64];
+};
+
+/* Set up [q] for at least [cap] processes (rounded up to a power of 2) */
+int mpmc_init(struct mpmc_queue_t * q, size_t cap);
+
+/* Return 0 on success, -1 if [q] is full */
+int mpmc_enqueue(struct mpmc_queue_t * q, struct pcb_t * proc);
+
+/* Return NULL if [q] is empty */
+struct pcb_t * mpmc_dequeue(struct mpmc_queue_t * q);
+
+/* Snapshot emptiness test, may be stale by the time it returns */
+int mpmc_empty(struct mpmc_queue_t * q);
+
+void mpmc_destroy(struct mpmc_queue_t * q);
+
+#endif
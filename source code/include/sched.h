@@ -1,28 +1,53 @@
-#ifndef QUEUE_H
-#define QUEUE_H
+#ifndef SCHED_H
+#define SCHED_H
 
 #include "common.h"
+#include <stdio.h>
 
-#ifndef MLQ_SCHED
-#define MLQ_SCHED
-#endif
+struct timer_id_t;
+
+/* Scheduling classes, chosen per run by the config file */
+enum sched_policy_t {
+	SCHED_MLQ,	// Multi-level queue, fixed slot budget per priority
+	SCHED_CFS	// Completely fair, weighted virtual runtime
+};
 
-#define MAX_PRIO 139
+/* Select the policy by name ("mlq", "cfs") before init_scheduler().
+ * Return 0 on success, -1 if the name is unknown */
+int sched_set_policy(const char * name);
 
 int queue_empty(void);
 
-void init_scheduler(void);
+/* Set up the run queue(s) for [num_cpus] CPUs */
+void init_scheduler(int num_cpus);
+
+/* Report scheduler counters and release the run queues */
 void finish_scheduler(void);
 
-/* Get the next process from ready queue */
-struct pcb_t * get_proc(void);
+/* Get the next process from ready queue for CPU [cpu] */
+struct pcb_t * get_proc(int cpu);
 
-/* Put a process back to run queue */
-void put_proc(struct pcb_t * proc);
+/* Put a process back to run queue of CPU [cpu], which is expected to
+ * call get_proc() right after: no waiter is woken for the process it
+ * takes back itself */
+void put_proc(int cpu, struct pcb_t * proc);
 
 /* Add a new process to ready queue */
 void add_proc(struct pcb_t * proc);
 
+/* Block the calling CPU until a process is put to a run queue or
+ * sched_stop() is called. Its [timer_id] stays parked meanwhile */
+void sched_wait(struct timer_id_t * timer_id);
+
+/* No more process will arrive, release every CPU in sched_wait() */
+void sched_stop(void);
+
+/* Write the run queues and their counters at a time slot boundary,
+ * [put] writes every queued process in queue order. sched_load() puts
+ * them back after init_scheduler(), [get] reads one process */
+void sched_save(FILE * f, void (*put)(FILE *, struct pcb_t *));
+void sched_load(FILE * f, struct pcb_t * (*get)(FILE *));
+
 #endif
 
 
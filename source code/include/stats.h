@@ -0,0 +1,35 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+#include <stdio.h>
+
+/* Marks a timestamp of the pcb_t which has not been taken yet */
+#define STATS_NEVER	((uint64_t)-1)
+
+/* Set up accounting for [num_cpus] CPUs */
+void stats_init(int num_cpus);
+
+/* [proc] is handed to the scheduler for the first time */
+void stats_arrive(struct pcb_t * proc);
+
+/* [proc] is dispatched on a CPU */
+void stats_dispatch(struct pcb_t * proc);
+
+/* [proc] is put back to the run queue at the end of its time slice */
+void stats_preempt(struct pcb_t * proc);
+
+/* [proc] has finished, keep its figures for the report */
+void stats_exit(struct pcb_t * proc);
+
+/* Record the busy and idle slot counts of [cpu] when it stops */
+void stats_cpu(int cpu, uint64_t busy, uint64_t idle);
+
+/* Write and read back the figures kept so far, see ckpt.h */
+void stats_save(FILE * f);
+void stats_load(FILE * f);
+
+/* Print per-process and per-CPU figures then release the storage */
+void stats_report(void);
+
+#endif
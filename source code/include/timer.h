@@ -7,10 +7,9 @@
 struct timer_id_t {
 	int done;
 	int fsh;
-	pthread_cond_t event_cond;
-	pthread_mutex_t event_lock;
-	pthread_cond_t timer_cond;
-	pthread_mutex_t timer_lock;
+	int parked;	// Waiting for work, the timer ticks without it
+	int sleeping;	// In sleep_until(), done for every slot before wake_at
+	uint64_t wake_at;
 };
 
 void start_timer();
@@ -21,8 +20,26 @@ struct timer_id_t * attach_event();
 
 void detach_event(struct timer_id_t * event);
 
+/* The device has nothing to do until further notice: every slot counts
+ * as done for it until unpark_event(), next_slot() must not be called
+ * in between */
+void park_event(struct timer_id_t * event);
+
+void unpark_event(struct timer_id_t * event);
+
 void next_slot(struct timer_id_t* timer_id);
 
+/* Same as calling next_slot() until current_time() reaches [slot], but
+ * lets the timer skip slots in which no device has anything to do */
+void sleep_until(struct timer_id_t * timer_id, uint64_t slot);
+
 uint64_t current_time();
 
+/* Call [fn] once time reaches [slot], at the boundary: every device is
+ * then done with the previous slot and none has started the next one */
+void timer_at(uint64_t slot, void (*fn)(void));
+
+/* Start the clock at [slot] instead of 0, before start_timer() */
+void timer_set(uint64_t slot);
+
 #endif
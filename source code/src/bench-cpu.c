@@ -0,0 +1,74 @@
+#include "cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ *  Interpreter benchmark:
+ *        bench-cpu [instructions]
+ *  Run [instructions] calc instructions (BENCH_INSTS by default) with
+ *  run() one instruction at a time, then with run_slice() in batches
+ *  of 1 and BENCH_BATCH. They loop over a code segment of BENCH_CODE
+ *  instructions, which stays in cache like the ones of real processes.
+ *  Calc touches no memory, so the figures are the dispatch cost alone.
+ *  Build with DEBUG=-O2 for figures worth comparing.
+ */
+
+#define BENCH_INSTS	50000000
+#define BENCH_CODE	4096
+#define BENCH_BATCH	1024
+
+static double now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Million instructions per second over [n] instructions of [proc], by
+ * run() if [batch] is 0, by run_slice() otherwise */
+static double minst_per_sec(struct pcb_t * proc, long n, int batch) {
+	long done;
+	double t;
+
+	t = now();
+	for (done = 0; done < n; done += proc->code->size) {
+		proc->pc = 0;
+		if (batch == 0)
+			while (proc->pc < proc->code->size)
+				run(proc);
+		else
+			while (proc->pc < proc->code->size)
+				run_slice(proc, batch);
+	}
+	t = now() - t;
+	return done / t / 1e6;
+}
+
+int main(int argc, char * argv[]) {
+	struct code_seg_t code = {0};
+	struct pcb_t proc = {0};
+	char label[32];
+	long n;
+
+	n = argc > 1 ? atol(argv[1]) : BENCH_INSTS;
+	if (argc > 2 || n <= 0) {
+		printf("Usage: bench-cpu [instructions]\n");
+		return 1;
+	}
+	/* Zeroed instructions are calc */
+	code.size = BENCH_CODE;
+	code.text = (struct inst_t *)calloc(BENCH_CODE, sizeof(struct inst_t));
+	if (code.text == NULL || predecode(&code) != 0) {
+		printf("Cannot allocate the code segment\n");
+		return 1;
+	}
+	proc.code = &code;
+
+	printf("Million instructions per second, %ld calc\n", n);
+	printf("%-20s %8.0f\n", "run()", minst_per_sec(&proc, n, 0));
+	printf("%-20s %8.0f\n", "run_slice(1)", minst_per_sec(&proc, n, 1));
+	snprintf(label, sizeof(label), "run_slice(%d)", BENCH_BATCH);
+	printf("%-20s %8.0f\n", label, minst_per_sec(&proc, n, BENCH_BATCH));
+	return 0;
+}
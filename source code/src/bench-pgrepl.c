@@ -0,0 +1,163 @@
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ *  Page replacement comparison:
+ *        bench-pgrepl [accesses]
+ *  BENCH_PROCS processes of BENCH_PAGES pages each share a MEMRAM of
+ *  BENCH_FRAMES frames, so replacement is global and heavy. The same
+ *  access trace, [accesses] long (BENCH_ACCESSES by default), runs
+ *  under every policy: most accesses follow a skewed hot set of their
+ *  process, one in BENCH_SCAN_EVERY scans its region in order. Each
+ *  policy runs in a child process of its own, the frame table is only
+ *  set up once per process. Every read is checked against a shadow
+ *  copy, exit 1 if one of them is wrong.
+ */
+
+#define BENCH_PROCS		8
+#define BENCH_PAGES		64
+#define BENCH_FRAMES		128
+#define BENCH_SWPSZ		0x100000
+#define BENCH_ACCESSES		200000
+#define BENCH_BURST		32
+#define BENCH_SCAN_EVERY	8
+
+static const char * bench_policies[] = {"fifo", "second", "clock", "lru", "lfu"};
+
+#define NELEMS(a)	((int)(sizeof(a) / sizeof((a)[0])))
+#define BENCH_RGSZ	(BENCH_PAGES * PAGING_PAGESZ)
+
+static struct memphy_struct mram;
+static struct memphy_struct mswp[PAGING_MAX_MMSWP];
+static struct memphy_struct * mswp_tab[PAGING_MAX_MMSWP];
+#ifdef CPU_TLB
+static struct memphy_struct tlb;
+#endif
+static struct pcb_t procs[BENCH_PROCS];
+static BYTE shadow[BENCH_PROCS][BENCH_RGSZ];
+static long accesses;
+
+/* Same trace for every policy, the seed is fixed */
+static unsigned int seed = 1;
+
+static unsigned int next_rand(void) {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) & 0xffffff;
+}
+
+static int setup(void) {
+	int i, addr;
+
+	init_memphy(&mram, BENCH_FRAMES * PAGING_PAGESZ, 1);
+	sem_init(&mram.memphylock, 0, 1);
+	for (i = 0; i < PAGING_MAX_MMSWP; i++) {
+		init_memphy(&mswp[i], i == 0 ? BENCH_SWPSZ : 0, 1);
+		sem_init(&mswp[i].memphylock, 0, 1);
+		mswp_tab[i] = &mswp[i];
+	}
+	swap_init(mswp_tab, PAGING_MAX_MMSWP);
+	if (pgrepl_init(BENCH_FRAMES) != 0)
+		return -1;
+#ifdef CPU_TLB
+	init_tlbmemphy(&tlb, 0x10000);
+#endif
+	for (i = 0; i < BENCH_PROCS; i++) {
+		procs[i].pid = i + 1;
+		procs[i].mm = calloc(1, sizeof(struct mm_struct));
+		init_mm(procs[i].mm, &procs[i]);
+		procs[i].mram = &mram;
+		procs[i].mswp = mswp_tab;
+		procs[i].active_mswp = &mswp[0];
+#ifdef CPU_TLB
+		procs[i].tlb = &tlb;
+#endif
+		sem_init(&procs[i].mm->memlock, 0, 1);
+		if (__alloc(&procs[i], 0, 0, BENCH_RGSZ, &addr) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Run the trace, return the number of wrong reads, -1 on a failed access */
+static long run_trace(void) {
+	int scan[BENCH_PROCS] = {0};
+	long i, bad = 0;
+	int p = 0, page, offset;
+	unsigned int r;
+	BYTE data;
+
+	for (i = 0; i < accesses; i++) {
+		/* A process keeps the CPU for a burst of accesses */
+		if (i % BENCH_BURST == 0)
+			p = next_rand() % BENCH_PROCS;
+		r = next_rand();
+		if (r % BENCH_SCAN_EVERY == 0) {
+			page = scan[p];
+			scan[p] = (scan[p] + 1) % BENCH_PAGES;
+		} else {
+			/* Cube of a uniform draw, page 0 is the hottest */
+			double u = (double)next_rand() / 0x1000000;
+			page = (int)(u * u * u * BENCH_PAGES);
+		}
+		offset = page * PAGING_PAGESZ + next_rand() % PAGING_PAGESZ;
+		if (r & 0x100) {
+			data = (BYTE)(r >> 12);
+			if (__write(&procs[p], 0, 0, offset, data) != 0)
+				return -1;
+			shadow[p][offset] = data;
+		} else {
+			if (__read(&procs[p], 0, 0, offset, &data) != 0)
+				return -1;
+			if (data != shadow[p][offset])
+				bad++;
+		}
+	}
+	return bad;
+}
+
+int main(int argc, char * argv[]) {
+	int i, out, status, failed = 0;
+	long bad;
+	pid_t pid;
+
+	accesses = argc > 1 ? atol(argv[1]) : BENCH_ACCESSES;
+	if (argc > 2 || accesses <= 0) {
+		printf("Usage: bench-pgrepl [accesses]\n");
+		return 1;
+	}
+	printf("Page replacement, %d processes of %d pages over %d frames, %ld accesses\n",
+		BENCH_PROCS, BENCH_PAGES, BENCH_FRAMES, accesses);
+	fflush(stdout);
+	for (i = 0; i < NELEMS(bench_policies); i++) {
+		if ((pid = fork()) < 0) {
+			printf("Cannot fork\n");
+			return 1;
+		}
+		if (pid == 0) {
+			pgrepl_set_policy(bench_policies[i]);
+			/* Keep the real stdout for the result only */
+			out = dup(STDOUT_FILENO);
+			if (freopen("/dev/null", "w", stdout) == NULL)
+				return 1;
+			bad = setup() != 0 ? -1 : run_trace();
+			fflush(stdout);
+			dup2(out, STDOUT_FILENO);
+			if (bad < 0) {
+				printf("%-6s cannot run the trace\n", bench_policies[i]);
+				return 1;
+			}
+			pgrepl_report();
+			if (bad > 0)
+				printf("%-6s %ld wrong read(s)\n", bench_policies[i], bad);
+			return bad > 0;
+		}
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0)
+			failed = 1;
+	}
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed;
+}
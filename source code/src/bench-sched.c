@@ -0,0 +1,167 @@
+#include "sched.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ *  Scheduler micro-benchmark:
+ *        bench-sched
+ *  Time a get_proc()/put_proc() pair on one run queue holding a number
+ *  of ready processes spread over a number of priority levels. Picking
+ *  a level is a find-first-set over the level bitmap, the cost should
+ *  stay flat along both axes. Build with DEBUG=-O2 for figures worth
+ *  comparing.
+ *
+ *  Slot distribution check of the MLQ round:
+ *        bench-sched slots
+ *  SLOTS_CPUS CPUs take a process each per slot and put it back at the
+ *  end of the slot, so a level whose processes all run looks empty to
+ *  the others meanwhile. Exit 1 if a level is not served in proportion
+ *  to its budget MAX_PRIO - prio.
+ */
+
+#define BENCH_DISPATCHES	2000000
+
+static const int bench_levels[] = {1, 10, 70, MAX_PRIO};
+static const int bench_ready[] = {10, 100, 1000, 10000};
+
+#define SLOTS_CPUS	4
+#define SLOTS_STEPS	100000
+
+static const int slots_levels[] = {0, 35, 70, 105, MAX_PRIO - 1};
+
+#define NELEMS(a)	((int)(sizeof(a) / sizeof((a)[0])))
+
+static double now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+#ifdef MLQ_SCHED
+/* Nanoseconds per dispatch with [ready] processes on [levels] levels.
+ * The run queues of the previous setup are left behind, init_scheduler()
+ * starts from empty ones */
+static double dispatch_ns(int levels, int ready) {
+	struct pcb_t * procs = calloc(ready, sizeof(struct pcb_t));
+	struct pcb_t * proc;
+	double t;
+	int i;
+
+	init_scheduler(1);
+	for (i = 0; i < ready; i++) {
+		procs[i].pid = i + 1;
+		procs[i].prio = (i % levels) * (MAX_PRIO / levels);
+		add_proc(&procs[i]);
+	}
+	t = now();
+	for (i = 0; i < BENCH_DISPATCHES; i++) {
+		proc = get_proc(0);
+		put_proc(0, proc);
+	}
+	t = now() - t;
+	while (get_proc(0) != NULL)
+		;
+	free(procs);
+	return t * 1e9 / BENCH_DISPATCHES;
+}
+
+/* Run [per_level] processes on each of slots_levels, count the slots
+ * given to every level in [count] */
+static void slots_run(int per_level, unsigned long * count) {
+	int n = NELEMS(slots_levels) * per_level;
+	struct pcb_t * procs = calloc(n, sizeof(struct pcb_t));
+	struct pcb_t * running[SLOTS_CPUS];
+	int i, c, step;
+
+	init_scheduler(SLOTS_CPUS);
+	for (i = 0; i < n; i++) {
+		procs[i].pid = i + 1;
+		procs[i].prio = slots_levels[i % NELEMS(slots_levels)];
+		add_proc(&procs[i]);
+	}
+	for (step = 0; step < SLOTS_STEPS; step++) {
+		for (c = 0; c < SLOTS_CPUS; c++)
+			if ((running[c] = get_proc(c)) != NULL)
+				count[running[c]->prio]++;
+		for (c = 0; c < SLOTS_CPUS; c++)
+			if (running[c] != NULL)
+				put_proc(c, running[c]);
+	}
+	for (c = 0; c < SLOTS_CPUS; c++)
+		while (get_proc(c) != NULL)
+			;
+	free(procs);
+}
+
+static int slots_check(void) {
+	unsigned long saturated[MAX_PRIO] = {0}, sparse[MAX_PRIO] = {0};
+	unsigned long total = 0, budgets = 0;
+	double share, expect;
+	int i, prio, bad = 0;
+
+	/* More processes per level than CPUs: a level never runs dry and
+	 * gets exactly its budget every round */
+	slots_run(SLOTS_CPUS + 1, saturated);
+	/* One process per level: the ones running on other CPUs must not
+	 * cost their level its turn */
+	slots_run(1, sparse);
+
+	for (i = 0; i < NELEMS(slots_levels); i++) {
+		total += saturated[slots_levels[i]];
+		budgets += MAX_PRIO - slots_levels[i];
+	}
+	printf("MLQ slots over %d steps of %d CPUs\n", SLOTS_STEPS, SLOTS_CPUS);
+	printf("%6s %8s %10s %10s %10s\n",
+		"prio", "budget", "expected", "saturated", "sparse");
+	for (i = 0; i < NELEMS(slots_levels); i++) {
+		prio = slots_levels[i];
+		expect = (double)(MAX_PRIO - prio) / budgets;
+		share = (double)saturated[prio] / total;
+		printf("%6d %8d %9.2f%% %9.2f%% %10lu\n", prio, MAX_PRIO - prio,
+			expect * 100, share * 100, sparse[prio]);
+		if (share < expect * 0.95 || share > expect * 1.05)
+			bad = 1;
+		if (i > 0 && sparse[prio] > sparse[slots_levels[i - 1]])
+			bad = 1;
+	}
+	/* Whatever a level cannot use goes to the lower ones, yet the
+	 * lowest must stay far behind the highest */
+	if (sparse[slots_levels[NELEMS(slots_levels) - 1]] * 10 >
+	    sparse[slots_levels[0]])
+		bad = 1;
+	printf("%s\n", bad ? "FAILED" : "OK");
+	return bad;
+}
+#endif
+
+int main(int argc, char * argv[]) {
+#ifdef MLQ_SCHED
+	int l, r;
+
+	if (argc == 2 && !strcmp(argv[1], "slots"))
+		return slots_check();
+	if (argc != 1) {
+		printf("Usage: bench-sched [slots]\n");
+		return 1;
+	}
+	printf("MLQ dispatch cost, ns per get_proc()/put_proc() pair\n");
+	printf("%8s", "levels");
+	for (r = 0; r < NELEMS(bench_ready); r++)
+		printf("  ready=%-6d", bench_ready[r]);
+	printf("\n");
+	for (l = 0; l < NELEMS(bench_levels); l++) {
+		printf("%8d", bench_levels[l]);
+		for (r = 0; r < NELEMS(bench_ready); r++)
+			printf("  %12.1f",
+				dispatch_ns(bench_levels[l], bench_ready[r]));
+		printf("\n");
+	}
+	return 0;
+#else
+	printf("bench-sched needs MLQ_SCHED in os-cfg.h\n");
+	return 1;
+#endif
+}
@@ -0,0 +1,92 @@
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ *  Time slot barrier benchmark:
+ *        bench-timer [slots]
+ *  Every device is a thread calling next_slot() in a loop, [slots] times
+ *  (BENCH_SLOTS by default). Each device count runs in a child process
+ *  of its own, the timer is only set up once per process, and the slot
+ *  headers the timer prints are thrown away.
+ */
+
+#define BENCH_SLOTS	5000
+
+static const int bench_devices[] = {1, 8, 64, 256};
+
+static int slots;
+
+static void * device(void * arg) {
+	struct timer_id_t * timer_id = (struct timer_id_t *)arg;
+	int i;
+
+	for (i = 0; i < slots; i++)
+		next_slot(timer_id);
+	detach_event(timer_id);
+	return NULL;
+}
+
+/* Slots per second with [n] devices, -1 if a thread cannot start */
+static double slots_per_sec(int n) {
+	struct timer_id_t ** ids = malloc(sizeof(struct timer_id_t *) * n);
+	pthread_t * threads = malloc(sizeof(pthread_t) * n);
+	struct timespec start, end;
+	int i;
+
+	for (i = 0; i < n; i++)
+		ids[i] = attach_event();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	start_timer();
+	for (i = 0; i < n; i++)
+		if (pthread_create(&threads[i], NULL, device, ids[i]) != 0)
+			return -1;
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	stop_timer();
+	free(threads);
+	free(ids);
+	return slots / ((end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char * argv[]) {
+	double rate;
+	int i, out;
+	pid_t pid;
+
+	slots = argc > 1 ? atoi(argv[1]) : BENCH_SLOTS;
+	if (argc > 2 || slots <= 0) {
+		printf("Usage: bench-timer [slots]\n");
+		return 1;
+	}
+	printf("Time slots per second, %d slots\n", slots);
+	fflush(stdout);
+	for (i = 0; i < (int)(sizeof(bench_devices) / sizeof(bench_devices[0])); i++) {
+		if ((pid = fork()) < 0) {
+			printf("Cannot fork\n");
+			return 1;
+		}
+		if (pid == 0) {
+			/* Keep the real stdout for the result only */
+			out = dup(STDOUT_FILENO);
+			if (freopen("/dev/null", "w", stdout) == NULL)
+				return 1;
+			rate = slots_per_sec(bench_devices[i]);
+			fflush(stdout);
+			dup2(out, STDOUT_FILENO);
+			if (rate < 0)
+				printf("%4d devices: cannot start the threads\n",
+					bench_devices[i]);
+			else
+				printf("%4d devices: %10.0f\n", bench_devices[i], rate);
+			return 0;
+		}
+		waitpid(pid, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,283 @@
+
+#include "ckpt.h"
+#include "loader.h"
+#include "cpu.h"
+#include "mm.h"
+#include <stdlib.h>
+#include <string.h>
+
+void ckpt_put(FILE * f, const void * buf, size_t len) {
+	if (len > 0 && fwrite(buf, len, 1, f) != 1) {
+		printf("Cannot write checkpoint\n");
+		exit(1);
+	}
+}
+
+void ckpt_get(FILE * f, void * buf, size_t len) {
+	if (len > 0 && fread(buf, len, 1, f) != 1) {
+		printf("Truncated checkpoint\n");
+		exit(1);
+	}
+}
+
+void ckpt_put_str(FILE * f, const char * s) {
+	uint32_t len = strlen(s);
+
+	ckpt_put(f, &len, sizeof(len));
+	ckpt_put(f, s, len);
+}
+
+char * ckpt_get_str(FILE * f) {
+	uint32_t len;
+	char * s;
+
+	ckpt_get(f, &len, sizeof(len));
+	s = (char *)malloc(len + 1);
+	ckpt_get(f, s, len);
+	s[len] = '\0';
+	return s;
+}
+
+#ifdef MM_PAGING
+static void put_freerg(unsigned long rg_start, unsigned long rg_end,
+		void * arg) {
+	FILE * f = (FILE *)arg;
+
+	ckpt_put(f, &rg_start, sizeof(rg_start));
+	ckpt_put(f, &rg_end, sizeof(rg_end));
+}
+
+/* Free regions by address, the index is rebuilt from them */
+static void put_freerg_tree(FILE * f, struct vm_freerg_tree * t) {
+	ckpt_put(f, &t->count, sizeof(t->count));
+	freerg_walk(t, put_freerg, f);
+}
+
+static void get_freerg_tree(FILE * f, struct vm_freerg_tree * t) {
+	unsigned long rg_start, rg_end;
+	int n;
+
+	freerg_init(t);
+	ckpt_get(f, &n, sizeof(n));
+	while (n-- > 0) {
+		ckpt_get(f, &rg_start, sizeof(rg_start));
+		ckpt_get(f, &rg_end, sizeof(rg_end));
+		if (freerg_insert(t, rg_start, rg_end) < 0) {
+			printf("Corrupted checkpoint\n");
+			exit(1);
+		}
+	}
+}
+
+static void put_pte(int pgn, uint32_t * pte, void * arg) {
+	FILE * f = (FILE *)arg;
+
+	if (*pte == 0)
+		return;
+	ckpt_put(f, &pgn, sizeof(pgn));
+	ckpt_put(f, pte, sizeof(*pte));
+}
+
+static void put_mm(FILE * f, struct mm_struct * mm) {
+	struct vm_area_struct * vma;
+	uint32_t n = 0;
+	int i, end = -1;
+
+	for (i = 0; i < PAGING_MAX_SYMTBL_SZ; i++) {
+		ckpt_put(f, &mm->symrgtbl[i].rg_start, sizeof(unsigned long));
+		ckpt_put(f, &mm->symrgtbl[i].rg_end, sizeof(unsigned long));
+	}
+	for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+		n++;
+	ckpt_put(f, &n, sizeof(n));
+	for (vma = mm->mmap; vma != NULL; vma = vma->vm_next) {
+		ckpt_put(f, &vma->vm_id, sizeof(vma->vm_id));
+		ckpt_put(f, &vma->vm_start, sizeof(vma->vm_start));
+		ckpt_put(f, &vma->vm_end, sizeof(vma->vm_end));
+		ckpt_put(f, &vma->sbrk, sizeof(vma->sbrk));
+		put_freerg_tree(f, &vma->vm_freerg);
+	}
+	/* Only the mapped PTEs, the table is rebuilt around them */
+	pgtbl_walk(mm, 0, PAGING_MAX_PGN, put_pte, f);
+	ckpt_put(f, &end, sizeof(end));
+}
+
+static struct mm_struct * get_mm(FILE * f) {
+	struct mm_struct * mm = calloc(1, sizeof(struct mm_struct));
+	struct vm_area_struct ** vtail = &mm->mmap, * vma;
+	uint32_t n, pte;
+	int i, pgn;
+
+	for (i = 0; i < PAGING_MAX_SYMTBL_SZ; i++) {
+		ckpt_get(f, &mm->symrgtbl[i].rg_start, sizeof(unsigned long));
+		ckpt_get(f, &mm->symrgtbl[i].rg_end, sizeof(unsigned long));
+	}
+	ckpt_get(f, &n, sizeof(n));
+	while (n-- > 0) {
+		vma = calloc(1, sizeof(struct vm_area_struct));
+		ckpt_get(f, &vma->vm_id, sizeof(vma->vm_id));
+		ckpt_get(f, &vma->vm_start, sizeof(vma->vm_start));
+		ckpt_get(f, &vma->vm_end, sizeof(vma->vm_end));
+		ckpt_get(f, &vma->sbrk, sizeof(vma->sbrk));
+		get_freerg_tree(f, &vma->vm_freerg);
+		vma->vm_mm = mm;
+		*vtail = vma;
+		vtail = &vma->vm_next;
+	}
+	for (;;) {
+		ckpt_get(f, &pgn, sizeof(pgn));
+		if (pgn < 0)
+			break;
+		ckpt_get(f, &pte, sizeof(pte));
+		if (pgtbl_set(mm, pgn, pte) < 0) {
+			printf("Cannot restore page table\n");
+			exit(1);
+		}
+	}
+	sem_init(&mm->memlock, 0, 1);
+	return mm;
+}
+
+void ckpt_put_memphy(FILE * f, struct memphy_struct * mp) {
+	struct framephy_struct * fp;
+	uint32_t n = 0;
+	int pg, off, len, end = -1;
+
+	ckpt_put(f, &mp->maxsz, sizeof(mp->maxsz));
+	ckpt_put(f, &mp->rdmflg, sizeof(mp->rdmflg));
+	ckpt_put(f, &mp->cursor, sizeof(mp->cursor));
+	/* Free frames as runs of consecutive FPNs (first, length), a
+	 * fresh device is a single run */
+	for (fp = mp->free_fp_list; fp != NULL; fp = fp->fp_next)
+		if (fp->fp_next == NULL || fp->fp_next->fpn != fp->fpn + 1)
+			n++;
+	ckpt_put(f, &n, sizeof(n));
+	for (fp = mp->free_fp_list; fp != NULL; fp = fp->fp_next) {
+		int first = fp->fpn, len = 1;
+
+		while (fp->fp_next != NULL && fp->fp_next->fpn == fp->fpn + 1) {
+			fp = fp->fp_next;
+			len++;
+		}
+		ckpt_put(f, &first, sizeof(first));
+		ckpt_put(f, &len, sizeof(len));
+	}
+	/* Sparse storage: (page index, page bytes) for the pages which
+	 * are not all zero, ended by index -1 */
+	for (pg = 0, off = 0; off < mp->maxsz; pg++, off += PAGING_PAGESZ) {
+		len = mp->maxsz - off < PAGING_PAGESZ ?
+			mp->maxsz - off : PAGING_PAGESZ;
+		for (n = 0; n < (uint32_t)len; n++)
+			if (mp->storage[off + n] != 0)
+				break;
+		if (n == (uint32_t)len)
+			continue;
+		ckpt_put(f, &pg, sizeof(pg));
+		ckpt_put(f, mp->storage + off, len);
+	}
+	ckpt_put(f, &end, sizeof(end));
+}
+
+void ckpt_get_memphy(FILE * f, struct memphy_struct * mp) {
+	struct framephy_struct * fp, ** tail;
+	uint32_t n;
+	int maxsz, pg, off, len, first;
+
+	ckpt_get(f, &maxsz, sizeof(maxsz));
+	if (maxsz != mp->maxsz) {
+		printf("Checkpoint memory size %d does not match %d\n",
+			maxsz, mp->maxsz);
+		exit(1);
+	}
+	ckpt_get(f, &mp->rdmflg, sizeof(mp->rdmflg));
+	ckpt_get(f, &mp->cursor, sizeof(mp->cursor));
+	while ((fp = mp->free_fp_list) != NULL) {
+		mp->free_fp_list = fp->fp_next;
+		free(fp);
+	}
+	tail = &mp->free_fp_list;
+	ckpt_get(f, &n, sizeof(n));
+	while (n-- > 0) {
+		ckpt_get(f, &first, sizeof(first));
+		ckpt_get(f, &len, sizeof(len));
+		while (len-- > 0) {
+			fp = calloc(1, sizeof(struct framephy_struct));
+			fp->fpn = first++;
+			*tail = fp;
+			tail = &fp->fp_next;
+		}
+	}
+	memset(mp->storage, 0, mp->maxsz);
+	for (;;) {
+		ckpt_get(f, &pg, sizeof(pg));
+		if (pg < 0)
+			break;
+		off = pg * PAGING_PAGESZ;
+		if (off >= mp->maxsz) {
+			printf("Corrupted checkpoint\n");
+			exit(1);
+		}
+		len = mp->maxsz - off < PAGING_PAGESZ ?
+			mp->maxsz - off : PAGING_PAGESZ;
+		ckpt_get(f, mp->storage + off, len);
+	}
+}
+#endif
+
+void ckpt_put_proc(FILE * f, struct pcb_t * proc) {
+	ckpt_put_str(f, code_path(proc->code));
+	ckpt_put(f, &proc->pid, sizeof(proc->pid));
+	ckpt_put(f, &proc->priority, sizeof(proc->priority));
+	ckpt_put(f, proc->regs, sizeof(proc->regs));
+	ckpt_put(f, &proc->pc, sizeof(proc->pc));
+	ckpt_put(f, &proc->bp, sizeof(proc->bp));
+#ifdef MLQ_SCHED
+	ckpt_put(f, &proc->prio, sizeof(proc->prio));
+	ckpt_put(f, &proc->cpu, sizeof(proc->cpu));
+	ckpt_put(f, &proc->vruntime, sizeof(proc->vruntime));
+	ckpt_put(f, &proc->slice, sizeof(proc->slice));
+#endif
+	ckpt_put(f, &proc->arrival, sizeof(proc->arrival));
+	ckpt_put(f, &proc->first_dispatch, sizeof(proc->first_dispatch));
+	ckpt_put(f, &proc->ready_since, sizeof(proc->ready_since));
+	ckpt_put(f, &proc->wait_time, sizeof(proc->wait_time));
+	ckpt_put(f, &proc->run_time, sizeof(proc->run_time));
+	ckpt_put(f, &proc->finish, sizeof(proc->finish));
+#ifdef MM_PAGING
+	put_mm(f, proc->mm);
+#endif
+}
+
+struct pcb_t * ckpt_get_proc(FILE * f) {
+	char * path = ckpt_get_str(f);
+	/* The code comes back from its file, shared as in the first run */
+	struct pcb_t * proc = load(path);
+
+	if (proc == NULL) {
+		printf("Cannot restore process from '%s'\n", path);
+		exit(1);
+	}
+	free(path);
+	predecode(proc->code);
+	ckpt_get(f, &proc->pid, sizeof(proc->pid));
+	ckpt_get(f, &proc->priority, sizeof(proc->priority));
+	ckpt_get(f, proc->regs, sizeof(proc->regs));
+	ckpt_get(f, &proc->pc, sizeof(proc->pc));
+	ckpt_get(f, &proc->bp, sizeof(proc->bp));
+#ifdef MLQ_SCHED
+	ckpt_get(f, &proc->prio, sizeof(proc->prio));
+	ckpt_get(f, &proc->cpu, sizeof(proc->cpu));
+	ckpt_get(f, &proc->vruntime, sizeof(proc->vruntime));
+	ckpt_get(f, &proc->slice, sizeof(proc->slice));
+#endif
+	ckpt_get(f, &proc->arrival, sizeof(proc->arrival));
+	ckpt_get(f, &proc->first_dispatch, sizeof(proc->first_dispatch));
+	ckpt_get(f, &proc->ready_since, sizeof(proc->ready_since));
+	ckpt_get(f, &proc->wait_time, sizeof(proc->wait_time));
+	ckpt_get(f, &proc->run_time, sizeof(proc->run_time));
+	ckpt_get(f, &proc->finish, sizeof(proc->finish));
+#ifdef MM_PAGING
+	proc->mm = get_mm(f);
+#endif
+	return proc;
+}
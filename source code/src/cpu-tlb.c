@@ -104,8 +104,12 @@ int tlbread(struct pcb_t * proc, uint32_t source,
     
   int pgnum = PAGING_PGN(addr);
 
+  /* Held from the lookup to the access, another CPU may evict the page
+   * and clear its TLB entry, see pg_evict() */
+  sem_wait(&proc->mm->memlock);
   // Assuming tlb_cache_read returns -1 on failure
   if (tlb_cache_read(proc->tlb, proc->pid, pgnum, &frmnum) == -1) {
+      sem_post(&proc->mm->memlock);
       printf("Failed to read TLB cache\n");
       return -1;
   }
@@ -128,27 +132,33 @@ int tlbread(struct pcb_t * proc, uint32_t source,
 #endif
 
   if (frmnum >= 0) {
-    int phyaddr = (frmnum << PAGING_ADDR_FPN_LOBIT) + offset;
+    int phyaddr = (frmnum << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(addr);
     MEMPHY_read(proc->mram, phyaddr, &data);
+    pgrepl_touch(proc->mm, pgnum);
+    sem_post(&proc->mm->memlock);
     destination = (uint32_t) data;
     return 0;
   }
 
-  int val = __read(proc, 0, source, offset, &data);
+  int val = pg_getval(proc->mm, addr, &data, proc);
+  if (val != 0)
+    printf("*read region=%d offset=%d failed\n", source, offset);
   destination = (uint32_t) data;
 
   /* TODO update TLB CACHED with frame num of recent accessing page(s)*/
   /* by using tlb_cache_read()/tlb_cache_write()*/
 
-  uint32_t pte = proc->mm->pgd[pgnum];
+  uint32_t pte = pgtbl_get(proc->mm, pgnum);
   frmnum = PAGING_FPN(pte);
 
   if (val == 0) {
       if (tlb_cache_write(proc->tlb, proc->pid, pgnum, frmnum) == -1) {
+          sem_post(&proc->mm->memlock);
           printf("Failed to update TLB cache\n");
           return -1;
       }
   }
+  sem_post(&proc->mm->memlock);
   TLBMEMPHY_dump(proc->tlb);
   print_pgtbl(proc, 0, -1);
 
@@ -182,6 +192,8 @@ int tlbwrite(struct pcb_t * proc, BYTE data,
   }
   int addr = currg->rg_start + offset;
   int pgnum = PAGING_PGN(addr);
+  /* Held from the lookup to the access, see tlbread() */
+  sem_wait(&proc->mm->memlock);
   tlb_cache_read(proc->tlb, proc->pid, pgnum, &frmnum);
 
 #ifdef IODUMP
@@ -202,30 +214,139 @@ int tlbwrite(struct pcb_t * proc, BYTE data,
 #endif
 
   if (frmnum >= 0) {
-    int phyaddr = (frmnum << PAGING_ADDR_FPN_LOBIT) + offset;
-    MEMPHY_write(proc->mram,phyaddr, val);
+    int phyaddr = (frmnum << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(addr);
+    MEMPHY_write(proc->mram, phyaddr, data);
+    pg_setdirty(proc->mm, pgnum);
+    pgrepl_touch(proc->mm, pgnum);
+    sem_post(&proc->mm->memlock);
     return 0;
   }
-  val = __write(proc, 0, destination, offset, data);
+  val = pg_setval(proc->mm, addr, data, proc);
+  if (val != 0)
+    printf("*write region=%d offset=%d failed\n", destination, offset);
 
   /* TODO update TLB CACHED with frame num of recent accessing page(s)*/
   /* by using tlb_cache_read()/tlb_cache_write()*/
 
-  uint32_t pte = proc->mm->pgd[pgnum];
+  uint32_t pte = pgtbl_get(proc->mm, pgnum);
   frmnum = PAGING_FPN(pte);
 
   if (val == 0) {
     if (tlb_cache_write(proc->tlb, proc->pid, pgnum, frmnum) == -1) {
+        sem_post(&proc->mm->memlock);
         printf("Failed to update TLB cache\n");
         return -1;
     }
   }
+  sem_post(&proc->mm->memlock);
 
   TLBMEMPHY_dump(proc->tlb);
   print_pgtbl(proc, 0, -1);
   return val;
 }
 
+/*tlb_translate - translate a page through the TLB cache
+ *@proc: Process executing the instruction, holding its memlock
+ *@pgn: PGN
+ *@fpn: return FPN
+ */
+static int tlb_translate(struct pcb_t *proc, int pgn, int *fpn)
+{
+  int frmnum = -1;
+
+  tlb_cache_read(proc->tlb, proc->pid, pgn, &frmnum);
+  if (frmnum >= 0) {
+#ifdef IODUMP
+    HIT++;
+#endif
+    pgrepl_touch(proc->mm, pgn);
+    *fpn = frmnum;
+    return 0;
+  }
+#ifdef IODUMP
+  MISS++;
+#endif
+  if (pg_getpage(proc->mm, pgn, fpn, proc) != 0)
+    return -1;
+  tlb_cache_write(proc->tlb, proc->pid, pgn, *fpn);
+  return 0;
+}
+
+/*tlbcopy - CPU TLB-based copy a region memory to another one
+ *@proc: Process executing the instruction
+ *@source: index of source register
+ *@destination: index of destination register
+ *@len: number of bytes to copy
+ */
+int tlbcopy(struct pcb_t * proc, uint32_t source,
+            uint32_t destination, uint32_t len)
+{
+  struct vm_rg_struct *src = get_symrg_byid(proc->mm, source);
+  struct vm_rg_struct *dst = get_symrg_byid(proc->mm, destination);
+  int val;
+
+  if (src == NULL || dst == NULL) {
+      printf("Invalid memory region ID\n");
+      return -1;
+  }
+  if (check_if_in_freerg_list(proc, 0, src) < 0 ||
+      check_if_in_freerg_list(proc, 0, dst) < 0) {
+      printf("Copy with freed region list\n");
+      return -1;
+  }
+
+  /* One TLB lookup per page instead of per byte */
+  val = __copy(proc, 0, source, destination, len, tlb_translate);
+
+#ifdef IODUMP
+  printf("TLB copy region=%d to region=%d len=%d\n",
+         source, destination, len);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+#endif
+
+  TLBMEMPHY_dump(proc->tlb);
+  return val;
+}
+
+/*tlbfill - CPU TLB-based fill a region memory with a value
+ *@proc: Process executing the instruction
+ *@destination: index of destination register
+ *@data: value written
+ *@len: number of bytes to set
+ */
+int tlbfill(struct pcb_t * proc, uint32_t destination,
+            BYTE data, uint32_t len)
+{
+  struct vm_rg_struct *currg = get_symrg_byid(proc->mm, destination);
+  int val;
+
+  if (currg == NULL) {
+      printf("Invalid memory region ID\n");
+      return -1;
+  }
+  if (check_if_in_freerg_list(proc, 0, currg) < 0) {
+      printf("Fill to freed region list\n");
+      return -1;
+  }
+
+  val = __fill(proc, 0, destination, data, len, tlb_translate);
+
+#ifdef IODUMP
+  printf("TLB fill region=%d value=%d len=%d\n",
+         destination, data, len);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+#endif
+
+  TLBMEMPHY_dump(proc->tlb);
+  return val;
+}
+
 
 void result_TLB() {
   printf("RESULT OF TLB: \n");
@@ -2,6 +2,7 @@
 #include "cpu.h"
 #include "mem.h"
 #include "mm.h"
+#include <stdlib.h>
 
 int calc(struct pcb_t * proc) {
 	return ((unsigned long)proc & 0UL);
@@ -45,6 +46,35 @@ int write(
 	return write_mem(proc->regs[destination] + offset, proc, data);
 } 
 
+int copy(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t source, // Index of source register
+		uint32_t destination, // Index of destination register
+		uint32_t len) { // Number of bytes to copy
+	BYTE data;
+	uint32_t i;
+
+	for (i = 0; i < len; i++) {
+		if (read_mem(proc->regs[source] + i, proc, &data) ||
+		    write_mem(proc->regs[destination] + i, proc, data))
+			return 1;
+	}
+	return 0;
+}
+
+int fill(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t destination, // Index of destination register
+		BYTE data, // Data to be written into memory
+		uint32_t len) { // Number of bytes to set
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		if (write_mem(proc->regs[destination] + i, proc, data))
+			return 1;
+	return 0;
+}
+
 int run(struct pcb_t * proc) {
 	/* Check if Program Counter point to the proper instruction */
 	if (proc->pc >= proc->code->size) {
@@ -92,6 +122,24 @@ int run(struct pcb_t * proc) {
 		stat = pgwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #else
 		stat = write(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#endif
+		break;
+	case COPY:
+#ifdef CPU_TLB
+		stat = tlbcopy(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#elif defined(MM_PAGING)
+		stat = pgcopy(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#else
+		stat = copy(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#endif
+		break;
+	case FILL:
+#ifdef CPU_TLB
+		stat = tlbfill(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#elif defined(MM_PAGING)
+		stat = pgfill(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#else
+		stat = fill(proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #endif
 		break;
 	default:
@@ -101,4 +149,164 @@ int run(struct pcb_t * proc) {
 
 }
 
+/*
+ *  Memory instructions bound to the backend selected at build time, in
+ *  the uniform op_handler_t shape. The #ifdef chain of run() is thus
+ *  resolved once per instruction by predecode(), not once per run.
+ */
+static int op_alloc(struct pcb_t * proc,
+		uint32_t arg_0, uint32_t arg_1, uint32_t arg_2) {
+#ifdef CPU_TLB
+	return tlballoc(proc, arg_0, arg_1);
+#elif defined(MM_PAGING)
+	return pgalloc(proc, arg_0, arg_1);
+#else
+	return alloc(proc, arg_0, arg_1);
+#endif
+}
+
+static int op_free(struct pcb_t * proc,
+		uint32_t arg_0, uint32_t arg_1, uint32_t arg_2) {
+#ifdef CPU_TLB
+	return tlbfree_data(proc, arg_0);
+#elif defined(MM_PAGING)
+	return pgfree_data(proc, arg_0);
+#else
+	return free_data(proc, arg_0);
+#endif
+}
+
+static int op_read(struct pcb_t * proc,
+		uint32_t arg_0, uint32_t arg_1, uint32_t arg_2) {
+#ifdef CPU_TLB
+	return tlbread(proc, arg_0, arg_1, arg_2);
+#elif defined(MM_PAGING)
+	return pgread(proc, arg_0, arg_1, arg_2);
+#else
+	return read(proc, arg_0, arg_1, arg_2);
+#endif
+}
+
+static int op_write(struct pcb_t * proc,
+		uint32_t arg_0, uint32_t arg_1, uint32_t arg_2) {
+#ifdef CPU_TLB
+	return tlbwrite(proc, arg_0, arg_1, arg_2);
+#elif defined(MM_PAGING)
+	return pgwrite(proc, arg_0, arg_1, arg_2);
+#else
+	return write(proc, arg_0, arg_1, arg_2);
+#endif
+}
+
+static int op_copy(struct pcb_t * proc,
+		uint32_t arg_0, uint32_t arg_1, uint32_t arg_2) {
+#ifdef CPU_TLB
+	return tlbcopy(proc, arg_0, arg_1, arg_2);
+#elif defined(MM_PAGING)
+	return pgcopy(proc, arg_0, arg_1, arg_2);
+#else
+	return copy(proc, arg_0, arg_1, arg_2);
+#endif
+}
+
+static int op_fill(struct pcb_t * proc,
+		uint32_t arg_0, uint32_t arg_1, uint32_t arg_2) {
+#ifdef CPU_TLB
+	return tlbfill(proc, arg_0, arg_1, arg_2);
+#elif defined(MM_PAGING)
+	return pgfill(proc, arg_0, arg_1, arg_2);
+#else
+	return fill(proc, arg_0, arg_1, arg_2);
+#endif
+}
+
+static const op_handler_t op_handlers[] = {
+	[CALC] = NULL,
+	[ALLOC] = op_alloc,
+	[FREE] = op_free,
+	[READ] = op_read,
+	[WRITE] = op_write,
+	[COPY] = op_copy,
+	[FILL] = op_fill,
+};
+
+int predecode(struct code_seg_t * code) {
+	struct dinst_t * ops, * expected = NULL;
+	uint32_t i;
+
+	if (__atomic_load_n(&code->ops, __ATOMIC_ACQUIRE) != NULL)
+		return 0;
+	ops = (struct dinst_t *)malloc(sizeof(struct dinst_t) *
+		(code->size ? code->size : 1));
+	if (ops == NULL)
+		return -1;
+	for (i = 0; i < code->size; i++) {
+		ops[i].opcode = code->text[i].opcode;
+		ops[i].handler = op_handlers[code->text[i].opcode];
+		ops[i].arg_0 = code->text[i].arg_0;
+		ops[i].arg_1 = code->text[i].arg_1;
+		ops[i].arg_2 = code->text[i].arg_2;
+	}
+	/* Another process sharing the segment may have won the race */
+	if (!__atomic_compare_exchange_n(&code->ops, &expected, ops, 0,
+			__ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		free(ops);
+	return 0;
+}
+
+int run_slice(struct pcb_t * proc, int n) {
+	const struct dinst_t * ops = proc->code->ops;
+	const struct dinst_t * op;
+	uint32_t start = proc->pc, pc = start;
+	uint32_t end = proc->code->size;
+
+	if (n <= 0 || pc >= end)
+		return 0;
+	if (end - pc > (uint32_t)n)
+		end = pc + n;
+	if (ops == NULL) {
+		/* Not decoded (out of memory), interpret the text */
+		while (proc->pc < end)
+			run(proc);
+		return end - start;
+	}
+#if defined(__GNUC__)
+	/* Threaded dispatch, every handler jumps straight to the next */
+	static void * const dispatch[] = {
+		[CALC] = &&do_calc,
+		[ALLOC] = &&do_mem,
+		[FREE] = &&do_mem,
+		[READ] = &&do_mem,
+		[WRITE] = &&do_mem,
+		[COPY] = &&do_mem,
+		[FILL] = &&do_mem,
+	};
+#define DISPATCH() do {					\
+		if (pc >= end)				\
+			goto out;			\
+		op = &ops[pc++];			\
+		goto *dispatch[op->opcode];		\
+	} while (0)
 
+	DISPATCH();
+do_calc:
+	DISPATCH();
+do_mem:
+	/* The handler may look at the PC, keep it current */
+	proc->pc = pc;
+	op->handler(proc, op->arg_0, op->arg_1, op->arg_2);
+	DISPATCH();
+out:
+#undef DISPATCH
+#else
+	while (pc < end) {
+		op = &ops[pc++];
+		if (op->handler != NULL) {
+			proc->pc = pc;
+			op->handler(proc, op->arg_0, op->arg_1, op->arg_2);
+		}
+	}
+#endif
+	proc->pc = pc;
+	return pc - start;
+}
@@ -0,0 +1,325 @@
+
+#include "os-cfg.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *  Generate a synthetic workload: one configure file [out]/[name] and
+ *  the process descriptions [out]/proc/[name]_[i] it runs:
+ *        gen [options] [name]
+ *  The os looks for relative process names in input/proc/, so unless
+ *  [out] is input they are written with the absolute path of [out].
+ *  Arrivals follow a Poisson process, every process allocates a working
+ *  set spread over a few regions then reads and writes it following the
+ *  selected access pattern. The same seed always gives the same files.
+ */
+
+#define GEN_REGIONS	10	// One per register of pcb_t
+#define GEN_PAGESZ	256	// Granularity of the zipf pattern
+#define GEN_PATHSZ	512
+
+enum access_t { ACC_SEQ, ACC_UNIFORM, ACC_ZIPF, ACC_PHASE };
+
+static const char * acc_names[] = {
+	[ACC_SEQ] = "seq",
+	[ACC_UNIFORM] = "uniform",
+	[ACC_ZIPF] = "zipf",
+	[ACC_PHASE] = "phase",
+};
+
+static struct {
+	int procs;		// -n: number of processes
+	double rate;		// -r: mean arrivals per time slot
+	int prio_lo, prio_hi;	// -p: priorities drawn in [lo, hi]
+	int prio_skew;		// -p: favour low values (high priorities)
+	int wss;		// -w: working set of a process, in bytes
+	enum access_t acc;	// -a: access pattern
+	int length;		// -l: instructions per process
+	int calc_pct;		// -c: share of CALC instructions
+	int write_pct;		// -W: share of writes among accesses
+	int time_slot;		// -t
+	int cpus;		// -C
+	const char * policy;	// -P: "sched" directive, none if NULL
+	uint64_t seed;		// -s
+	const char * out;	// -o
+} opt = {
+	.procs = 10,
+	.rate = 1.0,
+	.prio_lo = 0,
+	.prio_hi = MAX_PRIO - 1,
+	.wss = 1024,
+	.acc = ACC_UNIFORM,
+	.length = 100,
+	.calc_pct = 20,
+	.write_pct = 30,
+	.time_slot = 2,
+	.cpus = 4,
+	.seed = 1,
+	.out = "input",
+};
+
+static uint64_t rng_state;
+
+/* xorshift64*, small and identical on every libc */
+static uint64_t rng(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 2685821657736338717ULL;
+}
+
+/* Uniform in [0, 1) */
+static double rng_unit(void) {
+	return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int rng_range(int n) {
+	return (int)(rng_unit() * n);
+}
+
+static int draw_prio(void) {
+	int span = opt.prio_hi - opt.prio_lo + 1;
+
+	if (opt.prio_skew) {
+		/* Square of a uniform draw, piles up towards [lo] */
+		double u = rng_unit();
+		return opt.prio_lo + (int)(u * u * span);
+	}
+	return opt.prio_lo + rng_range(span);
+}
+
+/* Cumulative weights of pages for the zipf pattern (s = 1) */
+static double * zipf_cdf;
+static int zipf_pages;
+
+static void zipf_init(void) {
+	double sum = 0;
+	int i;
+
+	zipf_pages = (opt.wss + GEN_PAGESZ - 1) / GEN_PAGESZ;
+	zipf_cdf = (double *)malloc(sizeof(double) * zipf_pages);
+	for (i = 0; i < zipf_pages; i++)
+		zipf_cdf[i] = (sum += 1.0 / (i + 1));
+	for (i = 0; i < zipf_pages; i++)
+		zipf_cdf[i] /= sum;
+}
+
+static int zipf_page(void) {
+	double u = rng_unit();
+	int lo = 0, hi = zipf_pages - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (zipf_cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Next byte of the working set touched by the [i]-th instruction */
+static int next_addr(int i, int * cursor) {
+	int addr, hot, base;
+
+	switch (opt.acc) {
+	case ACC_SEQ:
+		addr = *cursor;
+		*cursor = (*cursor + 1) % opt.wss;
+		return addr;
+	case ACC_ZIPF:
+		/* Popular pages are scattered, not packed at the start */
+		addr = (int)(((uint64_t)zipf_page() * 2654435761u) % zipf_pages)
+			* GEN_PAGESZ + rng_range(GEN_PAGESZ);
+		return addr < opt.wss ? addr : addr % opt.wss;
+	case ACC_PHASE:
+		/* An eighth of the working set is hot, it moves every
+		 * quarter of the program */
+		hot = opt.wss / 8 > 0 ? opt.wss / 8 : 1;
+		base = (i / ((opt.length + 3) / 4)) * hot * 3;
+		return (base + rng_range(hot)) % opt.wss;
+	case ACC_UNIFORM:
+	default:
+		return rng_range(opt.wss);
+	}
+}
+
+static int write_proc(const char * path, int prio) {
+	int nrg = opt.wss < GEN_REGIONS ? opt.wss : GEN_REGIONS;
+	int rgsz = (opt.wss + nrg - 1) / nrg;
+	int i, addr, cursor = 0;
+	FILE * file;
+
+	if ((file = fopen(path, "w")) == NULL) {
+		printf("Cannot create process description at '%s'\n", path);
+		return -1;
+	}
+	fprintf(file, "%d %d\n", prio, nrg * 2 + opt.length);
+	for (i = 0; i < nrg; i++)
+		fprintf(file, "alloc %d %d\n", rgsz, i);
+	for (i = 0; i < opt.length; i++) {
+		if (rng_range(100) < opt.calc_pct) {
+			fprintf(file, "calc\n");
+			continue;
+		}
+		addr = next_addr(i, &cursor);
+		if (rng_range(100) < opt.write_pct)
+			fprintf(file, "write %d %d %d\n", rng_range(256),
+				addr / rgsz, addr % rgsz);
+		else
+			fprintf(file, "read %d %d %d\n", addr / rgsz,
+				addr % rgsz, rng_range(GEN_REGIONS));
+	}
+	for (i = 0; i < nrg; i++)
+		fprintf(file, "free %d\n", i);
+	if (fclose(file) != 0) {
+		printf("Cannot write process description at '%s'\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Prefix of the process names in the configure file: none if [out] is
+ * the input directory of the os, its absolute path otherwise */
+static int proc_prefix(char * prefix, size_t size) {
+	char * out = realpath(opt.out, NULL);
+	char * input = realpath("input", NULL);
+	int ret = 0;
+
+	if (out == NULL) {
+		printf("Cannot find output directory '%s'\n", opt.out);
+		ret = -1;
+	}else if (input != NULL && !strcmp(out, input)) {
+		prefix[0] = '\0';
+	}else if ((size_t)snprintf(prefix, size, "%s/proc/", out) >= size) {
+		printf("Output directory path too long '%s'\n", out);
+		ret = -1;
+	}
+	free(out);
+	free(input);
+	return ret;
+}
+
+static int write_config(const char * name) {
+	char path[GEN_PATHSZ], prefix[GEN_PATHSZ];
+	double t = 0;
+	FILE * file;
+	int i;
+
+	if (proc_prefix(prefix, sizeof(prefix)) < 0)
+		return -1;
+	snprintf(path, sizeof(path), "%s/%s", opt.out, name);
+	if ((file = fopen(path, "w")) == NULL) {
+		printf("Cannot create configure file at '%s'\n", path);
+		return -1;
+	}
+	fprintf(file, "%d %d %d\n", opt.time_slot, opt.cpus, opt.procs);
+#if defined(CPU_TLB) && !defined(CPUTLB_FIXED_TLBSZ)
+	fprintf(file, "%d\n", 0x10000);
+#endif
+#if defined(MM_PAGING) && !defined(MM_FIXED_MEMSZ)
+	fprintf(file, "%d %d 0 0 0\n", 0x100000, 0x1000000);
+#endif
+	if (opt.policy != NULL)
+		fprintf(file, "sched %s\n", opt.policy);
+	for (i = 0; i < opt.procs; i++) {
+		int prio = draw_prio();
+
+		snprintf(path, sizeof(path), "%s/proc/%s_%d",
+			opt.out, name, i);
+		if (write_proc(path, prio) < 0) {
+			fclose(file);
+			return -1;
+		}
+		fprintf(file, "%lu %s%s_%d %d\n", (unsigned long)t, prefix,
+			name, i, prio);
+		/* Exponential inter-arrival time */
+		t += -log(1.0 - rng_unit()) / opt.rate;
+	}
+	if (fclose(file) != 0) {
+		printf("Cannot write configure file at '%s/%s'\n",
+			opt.out, name);
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(void) {
+	printf("Usage: gen [options] [name]\n"
+		"  -n N        number of processes (%d)\n"
+		"  -r RATE     mean arrivals per time slot (%.1f)\n"
+		"  -p LO:HI    priorities drawn uniformly in [LO, HI]\n"
+		"  -p skew:LO:HI  same, favouring LO\n"
+		"  -w BYTES    working set per process (%d)\n"
+		"  -a PATTERN  seq, uniform, zipf or phase (uniform)\n"
+		"  -l N        instructions per process (%d)\n"
+		"  -c PCT      share of calc instructions (%d)\n"
+		"  -W PCT      share of writes among memory accesses (%d)\n"
+		"  -t N        time slot (%d)\n"
+		"  -C N        number of CPUs (%d)\n"
+		"  -P POLICY   emit a \"sched POLICY\" directive\n"
+		"  -s SEED     random seed (1)\n"
+		"  -o DIR      output directory (input)\n",
+		opt.procs, opt.rate, opt.wss, opt.length, opt.calc_pct,
+		opt.write_pct, opt.time_slot, opt.cpus);
+}
+
+static int parse_prio(const char * arg) {
+	if (!strncmp(arg, "skew:", 5)) {
+		opt.prio_skew = 1;
+		arg += 5;
+	}
+	if (sscanf(arg, "%d:%d", &opt.prio_lo, &opt.prio_hi) != 2 ||
+	    opt.prio_lo < 0 || opt.prio_hi >= MAX_PRIO ||
+	    opt.prio_lo > opt.prio_hi)
+		return -1;
+	return 0;
+}
+
+static int parse_access(const char * arg) {
+	int i;
+
+	for (i = 0; i < (int)(sizeof(acc_names) / sizeof(acc_names[0])); i++)
+		if (!strcmp(arg, acc_names[i])) {
+			opt.acc = (enum access_t)i;
+			return 0;
+		}
+	return -1;
+}
+
+int main(int argc, char * argv[]) {
+	int i, bad = 0;
+
+	for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+		const char * arg = argv[i + 1];
+
+		switch (argv[i][1]) {
+		case 'n': bad |= (opt.procs = atoi(arg)) <= 0; break;
+		case 'r': bad |= (opt.rate = atof(arg)) <= 0; break;
+		case 'p': bad |= parse_prio(arg) < 0; break;
+		case 'w': bad |= (opt.wss = atoi(arg)) <= 0; break;
+		case 'a': bad |= parse_access(arg) < 0; break;
+		case 'l': bad |= (opt.length = atoi(arg)) < 0; break;
+		case 'c': bad |= (opt.calc_pct = atoi(arg)) < 0; break;
+		case 'W': bad |= (opt.write_pct = atoi(arg)) < 0; break;
+		case 't': bad |= (opt.time_slot = atoi(arg)) <= 0; break;
+		case 'C': bad |= (opt.cpus = atoi(arg)) <= 0; break;
+		case 'P': opt.policy = arg; break;
+		case 's': opt.seed = strtoull(arg, NULL, 0); break;
+		case 'o': opt.out = arg; break;
+		default: bad = 1;
+		}
+	}
+	if (bad || i != argc - 1) {
+		usage();
+		return 1;
+	}
+
+	/* xorshift must not start from 0 */
+	rng_state = opt.seed ? opt.seed : 0x9e3779b97f4a7c15ULL;
+	zipf_init();
+	return write_config(argv[i]) < 0 ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+
+#include "loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ *  Convert a process description from the text format to the binary
+ *  image format read by load():
+ *        imgconv [text input] [image output]
+ *  Any file load() accepts is a valid input, images included.
+ */
+int main(int argc, char * argv[]) {
+	struct pcb_t * proc;
+	struct img_header_t hdr;
+	FILE * out;
+
+	if (argc != 3) {
+		printf("Usage: imgconv [text input] [image output]\n");
+		return 1;
+	}
+	if ((proc = load(argv[1])) == NULL)
+		return 1;
+
+	hdr.magic = IMG_MAGIC;
+	hdr.version = IMG_VERSION;
+	hdr.priority = proc->priority;
+	hdr.size = proc->code->size;
+	if ((out = fopen(argv[2], "wb")) == NULL) {
+		printf("Cannot create process image at '%s'\n", argv[2]);
+		return 1;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+	    fwrite(proc->code->text, sizeof(struct inst_t),
+		   proc->code->size, out) != proc->code->size) {
+		printf("Cannot write process image at '%s'\n", argv[2]);
+		fclose(out);
+		return 1;
+	}
+	if (fclose(out) != 0) {
+		printf("Cannot write process image at '%s'\n", argv[2]);
+		return 1;
+	}
+	return 0;
+}
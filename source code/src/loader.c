@@ -3,16 +3,42 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-static uint32_t avail_pid = 1;
+/*
+ *  Code segments are interned by path: every process loaded from the
+ *  same file shares one read-only code_seg_t, which is released once
+ *  the last of them is gone (release_code). The cache is a chained
+ *  hash table under [code_cache_lock], as CPUs release segments while
+ *  the loader looks them up.
+ */
+#define CODE_CACHE_BITS	8
+
+struct code_cache_t {
+	struct code_seg_t code;	// First, release_code() casts back
+	uint32_t priority;	// Default priority read with the code
+	uint32_t hash;
+	char * path;
+	struct code_cache_t * next;
+};
+
+static struct code_cache_t * code_cache[1 << CODE_CACHE_BITS];
+static pthread_mutex_t code_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define OPT_CALC	"calc"
 #define OPT_ALLOC	"alloc"
 #define OPT_FREE	"free"
 #define OPT_READ	"read"
 #define OPT_WRITE	"write"
+#define OPT_COPY	"copy"
+#define OPT_FILL	"fill"
 
-static enum ins_opcode_t get_opcode(char * opt) {
+/* The image stores inst_t as is, make sure it is packed as documented */
+typedef char inst_t_is_16_bytes[(sizeof(struct inst_t) == 16) ? 1 : -1];
+
+static int get_opcode(char * opt) {
 	if (!strcmp(opt, OPT_CALC)) {
 		return CALC;
 	}else if (!strcmp(opt, OPT_ALLOC)) {
@@ -23,69 +49,223 @@ static enum ins_opcode_t get_opcode(char * opt) {
 		return READ;
 	}else if (!strcmp(opt, OPT_WRITE)) {
 		return WRITE;
+	}else if (!strcmp(opt, OPT_COPY)) {
+		return COPY;
+	}else if (!strcmp(opt, OPT_FILL)) {
+		return FILL;
 	}else{
-		printf("Opcode: %s\n", opt);
-		exit(1);
+		return -1;
 	}
 }
 
-struct pcb_t * load(const char * path) {
-	/* Create new PCB for the new process */
-	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
-	proc->page_table =
-		(struct page_table_t*)malloc(sizeof(struct page_table_t));
-	proc->bp = PAGE_SIZE;
-	proc->pc = 0;
+/* Map the binary image opened as [file]. Return 1 if the file is not an
+ * image, 0 if [proc->code] was set up and -1 if the image is malformed.
+ * Goes through stdio since cpu.c defines its own read() and write() */
+static int map_image(const char * path, FILE * file, struct pcb_t * proc) {
+	int fd = fileno(file);
+	struct img_header_t hdr;
+	struct stat st;
+	struct inst_t * text;
+	void * image;
+	uint32_t i;
 
-	/* Read process code from file */
-	FILE * file;
-	if ((file = fopen(path, "r")) == NULL) {
-		printf("Cannot find process description at '%s'\n", path);
-		exit(1);		
+	if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+	    hdr.magic != IMG_MAGIC)
+		return 1;
+	if (hdr.version != IMG_VERSION || fstat(fd, &st) < 0 ||
+	    (size_t)st.st_size != sizeof(hdr) +
+		(size_t)hdr.size * sizeof(struct inst_t)) {
+		printf("Malformed process image at '%s'\n", path);
+		return -1;
+	}
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (image == MAP_FAILED) {
+		printf("Cannot map process image at '%s'\n", path);
+		return -1;
 	}
+	text = (struct inst_t *)((char *)image + sizeof(hdr));
+	for (i = 0; i < hdr.size; i++)
+		if ((unsigned)text[i].opcode > FILL) {
+			printf("Opcode: %u in '%s'\n",
+				(unsigned)text[i].opcode, path);
+			munmap(image, st.st_size);
+			return -1;
+		}
+	proc->priority = hdr.priority;
+	proc->code->text = text;
+	proc->code->size = hdr.size;
+	proc->code->image = image;
+	proc->code->image_len = st.st_size;
+	return 0;
+}
+
+/* Parse the text format: "[priority] [size]" then one instruction per
+ * line. Return 0 on success, -1 if the description is malformed */
+static int parse_text(const char * path, FILE * file, struct pcb_t * proc) {
 	char opcode[10];
-	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
-	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
+	uint32_t i;
+	int op, n;
+	struct inst_t * ins;
+
+	if (fscanf(file, "%u %u", &proc->priority, &proc->code->size) != 2) {
+		printf("Malformed process description at '%s'\n", path);
+		return -1;
+	}
 	proc->code->text = (struct inst_t*)malloc(
 		sizeof(struct inst_t) * proc->code->size
 	);
-	uint32_t i = 0;
+	if (proc->code->text == NULL && proc->code->size > 0)
+		return -1;
 	for (i = 0; i < proc->code->size; i++) {
-		fscanf(file, "%s", opcode);
-		proc->code->text[i].opcode = get_opcode(opcode);
-		switch(proc->code->text[i].opcode) {
+		ins = &proc->code->text[i];
+		if (fscanf(file, "%9s", opcode) != 1) {
+			/* Some shipped descriptions announce more instructions
+			 * than they hold, keep the ones which are there */
+			proc->code->size = i;
+			break;
+		}
+		if ((op = get_opcode(opcode)) < 0) {
+			printf("Opcode: %s\n", opcode);
+			goto bad;
+		}
+		ins->opcode = (enum ins_opcode_t)op;
+		ins->arg_0 = ins->arg_1 = ins->arg_2 = 0;
+		switch(ins->opcode) {
 		case CALC:
+			n = 0;
 			break;
 		case ALLOC:
-			fscanf(
-				file,
-				"%u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1
-			);
+			n = 2 - fscanf(file, "%u %u\n",
+				&ins->arg_0, &ins->arg_1);
 			break;
 		case FREE:
-			fscanf(file, "%u\n", &proc->code->text[i].arg_0);
+			n = 1 - fscanf(file, "%u\n", &ins->arg_0);
 			break;
 		case READ:
 		case WRITE:
-			fscanf(
-				file,
-				"%u %u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1,
-				&proc->code->text[i].arg_2
-			);
-			break;	
+		case COPY:	// [source] [destination] [length]
+		case FILL:	// [region] [value] [length]
 		default:
-			printf("Opcode: %s\n", opcode);
-			exit(1);
+			n = 3 - fscanf(file, "%u %u %u\n",
+				&ins->arg_0, &ins->arg_1, &ins->arg_2);
+			break;
+		}
+		if (n != 0) {
+			printf("Missing argument of '%s' in '%s'\n", opcode, path);
+			goto bad;
 		}
 	}
+	return 0;
+bad:
+	free(proc->code->text);
+	proc->code->text = NULL;
+	return -1;
+}
+
+static uint32_t hash_path(const char * path) {
+	uint32_t h = 2166136261u;	/* FNV-1a */
+
+	while (*path)
+		h = (h ^ (unsigned char)*path++) * 16777619u;
+	return h;
+}
+
+/* Read the code at [path] into a new cache entry, NULL on failure */
+static struct code_cache_t * read_code(const char * path) {
+	struct code_cache_t * ent;
+	struct pcb_t tmp;
+	FILE * file;
+	int ret;
+
+	/* Read process code from file */
+	if ((file = fopen(path, "r")) == NULL) {
+		printf("Cannot find process description at '%s'\n", path);
+		return NULL;
+	}
+	ent = (struct code_cache_t *)calloc(1, sizeof(struct code_cache_t));
+	if (ent == NULL) {
+		fclose(file);
+		return NULL;
+	}
+	tmp.code = &ent->code;
+	ret = map_image(path, file, &tmp);
+	if (ret > 0) {
+		/* Not an image, fall back to the text format */
+		rewind(file);
+		ret = parse_text(path, file, &tmp);
+	}
+	fclose(file);
+	if (ret < 0) {
+		free(ent);
+		return NULL;
+	}
+	ent->priority = tmp.priority;
+	ent->path = strdup(path);
+	return ent;
+}
+
+struct pcb_t * load(const char * path) {
+	struct code_cache_t * ent;
+	uint32_t hash = hash_path(path);
+	struct code_cache_t ** bucket =
+		&code_cache[hash & ((1 << CODE_CACHE_BITS) - 1)];
+
+	pthread_mutex_lock(&code_cache_lock);
+	for (ent = *bucket; ent != NULL; ent = ent->next)
+		if (ent->hash == hash && !strcmp(ent->path, path))
+			break;
+	if (ent != NULL)
+		ent->code.refcnt++;
+	pthread_mutex_unlock(&code_cache_lock);
+
+	if (ent == NULL) {
+		/* Parse outside the lock. Two loaders racing on the same
+		 * path at worst each insert a segment, both stay valid */
+		if ((ent = read_code(path)) == NULL)
+			return NULL;
+		ent->hash = hash;
+		ent->code.refcnt = 1;
+		pthread_mutex_lock(&code_cache_lock);
+		ent->next = *bucket;
+		*bucket = ent;
+		pthread_mutex_unlock(&code_cache_lock);
+	}
+
+	/* Create new PCB for the new process */
+	struct pcb_t * proc = (struct pcb_t * )calloc(1, sizeof(struct pcb_t));
+	proc->code = &ent->code;
+	proc->priority = ent->priority;
+	proc->page_table =
+		(struct page_table_t*)calloc(1, sizeof(struct page_table_t));
+	proc->bp = PAGE_SIZE;
+	proc->pc = 0;
 	return proc;
 }
 
+const char * code_path(struct code_seg_t * code) {
+	return ((struct code_cache_t *)code)->path;
+}
+
+void release_code(struct code_seg_t * code) {
+	struct code_cache_t * ent = (struct code_cache_t *)code;
+	struct code_cache_t ** pp;
 
+	pthread_mutex_lock(&code_cache_lock);
+	if (--code->refcnt > 0) {
+		pthread_mutex_unlock(&code_cache_lock);
+		return;
+	}
+	pp = &code_cache[ent->hash & ((1 << CODE_CACHE_BITS) - 1)];
+	while (*pp != ent)
+		pp = &(*pp)->next;
+	*pp = ent->next;
+	pthread_mutex_unlock(&code_cache_lock);
 
+	free(code->ops);
+	if (code->image != NULL)
+		munmap(code->image, code->image_len);
+	else
+		free(code->text);
+	free(ent->path);
+	free(ent);
+}
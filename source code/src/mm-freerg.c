@@ -0,0 +1,291 @@
+//#ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Free region index mm/mm-freerg.c
+ *
+ * The free regions of a vm area live in two treaps sharing their nodes:
+ * one ordered by address, to find the neighbours a freed region merges
+ * with, and one ordered by (size, address), to find the best fit. Both
+ * take O(log n) expected steps. Regions never overlap nor touch, two
+ * adjacent ones are always merged.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define RG_SIZE(n) ((n)->rg_end - (n)->rg_start)
+
+/*freerg_before - order of the nodes in a treap
+ *@a, @b: nodes
+ *@ord: FREERG_BY_ADDR or FREERG_BY_SIZE
+ */
+static int freerg_before(struct vm_freerg_node *a, struct vm_freerg_node *b,
+                         int ord)
+{
+  if (ord == FREERG_BY_SIZE && RG_SIZE(a) != RG_SIZE(b))
+    return RG_SIZE(a) < RG_SIZE(b);
+  return a->rg_start < b->rg_start;
+}
+
+/*treap_split - split a treap around a node not in it
+ *@root: treap
+ *@key: node to split around
+ *@ord: order of the treap
+ *@l, @r: return the nodes before [key] and the others
+ */
+static void treap_split(struct vm_freerg_node *root, struct vm_freerg_node *key,
+                        int ord, struct vm_freerg_node **l,
+                        struct vm_freerg_node **r)
+{
+  if (root == NULL)
+  {
+    *l = *r = NULL;
+  } else if (freerg_before(root, key, ord)) {
+    *l = root;
+    treap_split(root->child[ord][1], key, ord, &root->child[ord][1], r);
+  } else {
+    *r = root;
+    treap_split(root->child[ord][0], key, ord, l, &root->child[ord][0]);
+  }
+}
+
+/*treap_merge - join two treaps, every node of [l] before those of [r] */
+static struct vm_freerg_node *treap_merge(struct vm_freerg_node *l,
+                                          struct vm_freerg_node *r, int ord)
+{
+  if (l == NULL)
+    return r;
+  if (r == NULL)
+    return l;
+  if (l->prio > r->prio)
+  {
+    l->child[ord][1] = treap_merge(l->child[ord][1], r, ord);
+    return l;
+  }
+  r->child[ord][0] = treap_merge(l, r->child[ord][0], ord);
+  return r;
+}
+
+static struct vm_freerg_node *treap_insert(struct vm_freerg_node *root,
+                                           struct vm_freerg_node *node, int ord)
+{
+  if (root == NULL || node->prio > root->prio)
+  {
+    treap_split(root, node, ord, &node->child[ord][0], &node->child[ord][1]);
+    return node;
+  }
+  if (freerg_before(node, root, ord))
+    root->child[ord][0] = treap_insert(root->child[ord][0], node, ord);
+  else
+    root->child[ord][1] = treap_insert(root->child[ord][1], node, ord);
+  return root;
+}
+
+static struct vm_freerg_node *treap_remove(struct vm_freerg_node *root,
+                                           struct vm_freerg_node *node, int ord)
+{
+  if (root == node)
+    return treap_merge(node->child[ord][0], node->child[ord][1], ord);
+  if (freerg_before(node, root, ord))
+    root->child[ord][0] = treap_remove(root->child[ord][0], node, ord);
+  else
+    root->child[ord][1] = treap_remove(root->child[ord][1], node, ord);
+  return root;
+}
+
+static void freerg_link(struct vm_freerg_tree *t, struct vm_freerg_node *node)
+{
+  node->child[FREERG_BY_ADDR][0] = node->child[FREERG_BY_ADDR][1] = NULL;
+  node->child[FREERG_BY_SIZE][0] = node->child[FREERG_BY_SIZE][1] = NULL;
+  t->root[FREERG_BY_ADDR] = treap_insert(t->root[FREERG_BY_ADDR], node, FREERG_BY_ADDR);
+  t->root[FREERG_BY_SIZE] = treap_insert(t->root[FREERG_BY_SIZE], node, FREERG_BY_SIZE);
+}
+
+static void freerg_unlink(struct vm_freerg_tree *t, struct vm_freerg_node *node)
+{
+  t->root[FREERG_BY_ADDR] = treap_remove(t->root[FREERG_BY_ADDR], node, FREERG_BY_ADDR);
+  t->root[FREERG_BY_SIZE] = treap_remove(t->root[FREERG_BY_SIZE], node, FREERG_BY_SIZE);
+}
+
+/*freerg_init - set up an empty free region index
+ *@t: index
+ */
+void freerg_init(struct vm_freerg_tree *t)
+{
+  t->root[FREERG_BY_ADDR] = t->root[FREERG_BY_SIZE] = NULL;
+  t->count = 0;
+  /* Priorities come from a fixed sequence, runs stay reproducible */
+  t->seed = 2463534242u;
+}
+
+/*freerg_lookup - find the free region holding an address
+ *@t: index
+ *@addr: address
+ *
+ * Return NULL if [addr] is not free.
+ */
+struct vm_freerg_node *freerg_lookup(struct vm_freerg_tree *t,
+                                     unsigned long addr)
+{
+  struct vm_freerg_node *n = t->root[FREERG_BY_ADDR];
+
+  while (n != NULL)
+  {
+    if (addr < n->rg_start)
+      n = n->child[FREERG_BY_ADDR][0];
+    else if (addr >= n->rg_end)
+      n = n->child[FREERG_BY_ADDR][1];
+    else
+      return n;
+  }
+  return NULL;
+}
+
+/*freerg_insert - give a region back, merged with the free ones around it
+ *@t: index
+ *@start, @end: region [start, end)
+ *
+ * Return -1 if the region is empty or any part of it is already free.
+ */
+int freerg_insert(struct vm_freerg_tree *t, unsigned long start,
+                  unsigned long end)
+{
+  struct vm_freerg_node *n = t->root[FREERG_BY_ADDR];
+  struct vm_freerg_node *pred = NULL, *succ = NULL, *node;
+
+  if (start >= end)
+    return -1;
+
+  /* Closest free regions below and above [start] */
+  while (n != NULL)
+  {
+    if (n->rg_start < start)
+    {
+      pred = n;
+      n = n->child[FREERG_BY_ADDR][1];
+    } else {
+      succ = n;
+      n = n->child[FREERG_BY_ADDR][0];
+    }
+  }
+  if ((pred != NULL && pred->rg_end > start) ||
+      (succ != NULL && succ->rg_start < end))
+    return -1; /* Double free */
+
+  node = NULL;
+  if (pred != NULL && pred->rg_end == start)
+  {
+    freerg_unlink(t, pred);
+    start = pred->rg_start;
+    node = pred;
+    t->count--;
+  }
+  if (succ != NULL && succ->rg_start == end)
+  {
+    freerg_unlink(t, succ);
+    end = succ->rg_end;
+    if (node == NULL)
+      node = succ;
+    else
+      free(succ);
+    t->count--;
+  }
+  if (node == NULL)
+  {
+    node = malloc(sizeof(struct vm_freerg_node));
+    if (node == NULL)
+      return -1;
+    t->seed ^= t->seed << 13;
+    t->seed ^= t->seed >> 17;
+    t->seed ^= t->seed << 5;
+    node->prio = t->seed;
+  }
+  node->rg_start = start;
+  node->rg_end = end;
+  freerg_link(t, node);
+  t->count++;
+  return 0;
+}
+
+/*freerg_take - carve a region out of the smallest free one it fits in
+ *@t: index
+ *@size: size wanted
+ *@rg: return the region, at the start of the chosen free one
+ *
+ * Ties between free regions of the same size go to the lowest address.
+ * Return -1 if no free region is large enough.
+ */
+int freerg_take(struct vm_freerg_tree *t, unsigned long size,
+                struct vm_rg_struct *rg)
+{
+  struct vm_freerg_node *n = t->root[FREERG_BY_SIZE], *best = NULL;
+
+  while (n != NULL)
+  {
+    if (RG_SIZE(n) >= size)
+    {
+      best = n;
+      n = n->child[FREERG_BY_SIZE][0];
+    } else {
+      n = n->child[FREERG_BY_SIZE][1];
+    }
+  }
+  if (best == NULL)
+    return -1;
+
+  rg->rg_start = best->rg_start;
+  rg->rg_end = best->rg_start + size;
+  freerg_unlink(t, best);
+  if (RG_SIZE(best) > size)
+  {
+    /* The rest keeps the node, its neighbours are unchanged */
+    best->rg_start += size;
+    freerg_link(t, best);
+  } else {
+    free(best);
+    t->count--;
+  }
+  return 0;
+}
+
+static void freerg_walk_node(struct vm_freerg_node *n, freerg_fn_t fn,
+                             void *arg)
+{
+  while (n != NULL)
+  {
+    freerg_walk_node(n->child[FREERG_BY_ADDR][0], fn, arg);
+    fn(n->rg_start, n->rg_end, arg);
+    n = n->child[FREERG_BY_ADDR][1];
+  }
+}
+
+/*freerg_walk - visit the free regions by address
+ *@t: index
+ *@fn: callback, gets the bounds of each region
+ *@arg: passed to fn
+ */
+void freerg_walk(struct vm_freerg_tree *t, freerg_fn_t fn, void *arg)
+{
+  freerg_walk_node(t->root[FREERG_BY_ADDR], fn, arg);
+}
+
+static void freerg_free_node(struct vm_freerg_node *n)
+{
+  if (n == NULL)
+    return;
+  freerg_free_node(n->child[FREERG_BY_ADDR][0]);
+  freerg_free_node(n->child[FREERG_BY_ADDR][1]);
+  free(n);
+}
+
+/*freerg_free - release every node of an index
+ *@t: index
+ */
+void freerg_free(struct vm_freerg_tree *t)
+{
+  freerg_free_node(t->root[FREERG_BY_ADDR]);
+  freerg_init(t);
+}
+
+//#endif
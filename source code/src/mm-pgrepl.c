@@ -0,0 +1,545 @@
+//#ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Page replacement mm/mm-pgrepl.c
+ *
+ * Replacement is global: every MEMRAM frame holding a resident page has
+ * an entry in one frame table indexed by its FPN, whatever process owns
+ * it, so a faulting process may take the frame of any other. Entries are
+ * chained in lists, the policy decides which:
+ *   FIFO   one list in load order, the victim is its head
+ *   SECOND one list in load order, an accessed head goes to the tail
+ *          for a second chance
+ *   CLOCK  one list as a ring, the hand passes accessed pages over
+ *   LRU    the ring of CLOCK, aging: the hand shifts the accessed bit
+ *          into the age of every page it passes and the youngest of
+ *          a window of PGREPL_LRU_SCAN pages goes
+ *   LFU    one list per use count up to PGREPL_NLISTS - 1, the victim is
+ *          the oldest page of the lowest non-empty list (bitmap ffs)
+ * An access to a resident page only sets PAGING_PTE_ACCESSED_MASK in
+ * its PTE, under the memlock of its owner, which it holds anyway; the
+ * fault which loads a page does not. The policies read and clear that
+ * bit when they look for a victim, so the lists, guarded by
+ * [pgrepl_lock], only change on faults and evictions. LFU counts the
+ * accesses it finds that way, one per look at most.
+ *
+ * A page belongs to its owner's mm, it is only looked at with the
+ * memlock of its owner held: the caller holds its own, the one of
+ * another process is only tried, so the pages of a process busy on
+ * another CPU are passed over.
+ */
+
+#include "mm.h"
+#include "ckpt.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PGREPL_NLISTS 32
+#define PGREPL_LRU_SCAN 8
+#define PGREPL_AGE_TOP 0x80 /* Accessed since the last pass of the hand */
+
+/*
+ *  Resident page, entry of the frame table
+ */
+struct pgrepl_ent {
+  struct pcb_t *owner; /* NULL while the frame is not tracked */
+  int pgn;
+  int prev, next;  /* Frames of its list, -1 at the ends */
+  int count;       /* LFU use count, also the index of its list */
+  int age;         /* LRU, accessed bits of the last passes, newest on top */
+  int swptyp;      /* Swap slot still holding a copy of the page, */
+  int swpfpn;      /* swptyp -1 if there is none */
+};
+
+static enum pgrepl_policy_t pgrepl_policy = PGREPL_FIFO;
+
+static const char *pgrepl_name[] = {
+  [PGREPL_FIFO] = "fifo",
+  [PGREPL_SECOND] = "second",
+  [PGREPL_CLOCK] = "clock",
+  [PGREPL_LRU] = "lru",
+  [PGREPL_LFU] = "lfu",
+};
+
+static pthread_mutex_t pgrepl_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pgrepl_ent *pgrepl_ent;
+static int pgrepl_nframes;
+static int pgrepl_head[PGREPL_NLISTS], pgrepl_tail[PGREPL_NLISTS];
+static uint32_t pgrepl_nonempty; /* Bit i set if list i has an entry */
+static int pgrepl_nr;
+static int pgrepl_hand = -1; /* CLOCK and LRU, next frame looked at */
+
+/* Whole run figures, updated from every CPU */
+static unsigned long pgrepl_faults;
+static unsigned long pgrepl_zerofills;
+static unsigned long pgrepl_evictions;
+
+/*pgrepl_set_policy - select the policy by name before any process runs
+ *@name: "fifo", "second", "clock", "lru" or "lfu"
+ *
+ * Return -1 if the name is unknown.
+ */
+int pgrepl_set_policy(const char *name)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(pgrepl_name) / sizeof(pgrepl_name[0])); i++)
+    if (!strcmp(name, pgrepl_name[i]))
+    {
+      pgrepl_policy = (enum pgrepl_policy_t)i;
+      return 0;
+    }
+  return -1;
+}
+
+/*pgrepl_init - set up the frame table of MEMRAM
+ *@nframes: number of frames of MEMRAM
+ */
+int pgrepl_init(int nframes)
+{
+  int i;
+
+  pgrepl_ent = calloc(nframes, sizeof(struct pgrepl_ent));
+  if (pgrepl_ent == NULL)
+    return -1;
+  pgrepl_nframes = nframes;
+  for (i = 0; i < PGREPL_NLISTS; i++)
+    pgrepl_head[i] = pgrepl_tail[i] = -1;
+  pgrepl_nonempty = 0;
+  pgrepl_nr = 0;
+  pgrepl_hand = -1;
+  return 0;
+}
+
+/* Caller holds [pgrepl_lock] for the list helpers */
+static void list_push(int list, int fpn)
+{
+  struct pgrepl_ent *e = &pgrepl_ent[fpn];
+
+  e->next = -1;
+  e->prev = pgrepl_tail[list];
+  if (pgrepl_tail[list] >= 0)
+    pgrepl_ent[pgrepl_tail[list]].next = fpn;
+  else
+    pgrepl_head[list] = fpn;
+  pgrepl_tail[list] = fpn;
+  pgrepl_nonempty |= (uint32_t)1 << list;
+}
+
+/* Link [fpn] right before [at], an entry of [list] */
+static void list_insert(int list, int at, int fpn)
+{
+  struct pgrepl_ent *e = &pgrepl_ent[fpn];
+
+  e->next = at;
+  e->prev = pgrepl_ent[at].prev;
+  if (e->prev >= 0)
+    pgrepl_ent[e->prev].next = fpn;
+  else
+    pgrepl_head[list] = fpn;
+  pgrepl_ent[at].prev = fpn;
+}
+
+static void list_unlink(int list, int fpn)
+{
+  struct pgrepl_ent *e = &pgrepl_ent[fpn];
+
+  if (e->prev >= 0)
+    pgrepl_ent[e->prev].next = e->next;
+  else
+    pgrepl_head[list] = e->next;
+  if (e->next >= 0)
+    pgrepl_ent[e->next].prev = e->prev;
+  else
+    pgrepl_tail[list] = e->prev;
+  if (pgrepl_head[list] < 0)
+    pgrepl_nonempty &= ~((uint32_t)1 << list);
+}
+
+/* List an entry lives in */
+static inline int ent_list(int fpn)
+{
+  return pgrepl_policy == PGREPL_LFU ? pgrepl_ent[fpn].count : 0;
+}
+
+/* Policies turning a hand over the ring of list 0 */
+static inline int has_hand(void)
+{
+  return pgrepl_policy == PGREPL_CLOCK || pgrepl_policy == PGREPL_LRU;
+}
+
+/* Frame after [fpn] on the ring */
+static inline int ring_next(int fpn)
+{
+  return pgrepl_ent[fpn].next >= 0 ? pgrepl_ent[fpn].next : pgrepl_head[0];
+}
+
+/*pgrepl_add - track a page which was just made resident
+ *@owner: process the page belongs to, holding its memlock
+ *@pgn: PGN
+ *@fpn: MEMRAM frame of the page
+ *@swptyp: device index of the swap slot it was read from, -1 for none
+ *@swpfpn: frame on the device
+ */
+void pgrepl_add(struct pcb_t *owner, int pgn, int fpn, int swptyp, int swpfpn)
+{
+  struct pgrepl_ent *e = &pgrepl_ent[fpn];
+
+  pthread_mutex_lock(&pgrepl_lock);
+  e->owner = owner;
+  e->pgn = pgn;
+  e->count = 0;
+  e->age = PGREPL_AGE_TOP; /* The fault is its latest access */
+  e->swptyp = swptyp;
+  e->swpfpn = swpfpn;
+  if (has_hand() && pgrepl_hand >= 0)
+  {
+    /* Right behind the hand, a whole turn before it is looked at */
+    list_insert(0, pgrepl_hand, fpn);
+  } else {
+    list_push(0, fpn);
+    if (has_hand())
+      pgrepl_hand = fpn;
+  }
+  pgrepl_nr++;
+  pthread_mutex_unlock(&pgrepl_lock);
+}
+
+/*pgrepl_touch - mark a resident page accessed
+ *@mm: memory region of the owner, whose memlock is held
+ *@pgn: PGN
+ *
+ * For the accesses which do not go through pg_getpage(), a TLB hit.
+ */
+void pgrepl_touch(struct mm_struct *mm, int pgn)
+{
+  uint32_t *pte;
+
+  if (pgrepl_policy == PGREPL_FIFO)
+    return;
+  pte = pgtbl_lookup(mm, pgn);
+  if (pte != NULL && PAGING_PAGE_PRESENT(*pte) && !PAGING_PAGE_SWAPPED(*pte))
+    SETBIT(*pte, PAGING_PTE_ACCESSED_MASK);
+}
+
+/* Caller holds [pgrepl_lock]. Take the memlock of the owner of a frame
+ * unless it is the caller, which already holds it */
+static int ent_claim(struct pcb_t *caller, int fpn)
+{
+  struct mm_struct *mm = pgrepl_ent[fpn].owner->mm;
+
+  return mm == caller->mm || sem_trywait(&mm->memlock) == 0;
+}
+
+/* Give back what ent_claim() took */
+static void ent_release(struct pcb_t *caller, int fpn)
+{
+  struct mm_struct *mm = pgrepl_ent[fpn].owner->mm;
+
+  if (mm != caller->mm)
+    sem_post(&mm->memlock);
+}
+
+/* Frame claimed. Clear the accessed bit of its page, return the old one */
+static int ent_accessed(int fpn)
+{
+  struct pgrepl_ent *e = &pgrepl_ent[fpn];
+  uint32_t *pte = pgtbl_lookup(e->owner->mm, e->pgn);
+  int accessed;
+
+  if (pte == NULL)
+    return 0;
+  accessed = (*pte & PAGING_PTE_ACCESSED_MASK) != 0;
+  CLRBIT(*pte, PAGING_PTE_ACCESSED_MASK);
+  return accessed;
+}
+
+/*pgrepl_victim - choose the page to evict among every resident page
+ *@caller: faulting process, holding its memlock
+ *@retfpn: return MEMRAM frame of the victim
+ *
+ * The memlock of the owner of the victim is held on return, the caller
+ * gives it back after pgrepl_evict() or, if the page stays resident,
+ * right away. The entry is left as is until then. Return -1 if no page
+ * is resident or their owners are all busy.
+ */
+int pgrepl_victim(struct pcb_t *caller, int *retfpn)
+{
+  struct pgrepl_ent *e;
+  uint32_t lists;
+  int fpn, next, list, steps, seen, best = -1;
+
+  pthread_mutex_lock(&pgrepl_lock);
+  switch (pgrepl_policy)
+  {
+  case PGREPL_SECOND:
+    /* In two turns every page had its chance */
+    for (steps = 0; steps < 2 * pgrepl_nr && best < 0; steps++)
+    {
+      fpn = pgrepl_head[0];
+      if (ent_claim(caller, fpn))
+      {
+        if (!ent_accessed(fpn))
+        {
+          best = fpn;
+          break;
+        }
+        ent_release(caller, fpn);
+      }
+      list_unlink(0, fpn);
+      list_push(0, fpn);
+    }
+    break;
+  case PGREPL_CLOCK:
+    /* The chance of SECOND, the hand moves instead of the pages */
+    for (steps = 0; steps < 2 * pgrepl_nr && best < 0; steps++)
+    {
+      fpn = pgrepl_hand;
+      pgrepl_hand = ring_next(fpn);
+      if (ent_claim(caller, fpn))
+      {
+        if (!ent_accessed(fpn))
+          best = fpn;
+        else
+          ent_release(caller, fpn);
+      }
+    }
+    break;
+  case PGREPL_LRU:
+    /* The best so far stays claimed until a younger one shows up */
+    for (steps = seen = 0; steps < pgrepl_nr && seen < PGREPL_LRU_SCAN; steps++)
+    {
+      fpn = pgrepl_hand;
+      pgrepl_hand = ring_next(fpn);
+      if (!ent_claim(caller, fpn))
+        continue;
+      seen++;
+      e = &pgrepl_ent[fpn];
+      e->age = (e->age >> 1) | (ent_accessed(fpn) ? PGREPL_AGE_TOP : 0);
+      if (best >= 0 && pgrepl_ent[best].age <= e->age)
+      {
+        ent_release(caller, fpn);
+        continue;
+      }
+      if (best >= 0)
+        ent_release(caller, best);
+      best = fpn;
+    }
+    break;
+  case PGREPL_LFU:
+    /* A page accessed since the last look moves up one list, it is seen
+     * again there with its bit clear */
+    for (list = 0; list < PGREPL_NLISTS && best < 0; list++)
+    {
+      if (!(pgrepl_nonempty & ((uint32_t)1 << list)))
+        continue;
+      for (fpn = pgrepl_head[list]; fpn >= 0 && best < 0; fpn = next)
+      {
+        next = pgrepl_ent[fpn].next;
+        if (!ent_claim(caller, fpn))
+          continue;
+        e = &pgrepl_ent[fpn];
+        if (!ent_accessed(fpn))
+        {
+          best = fpn;
+          break;
+        }
+        if (e->count < PGREPL_NLISTS - 1)
+        {
+          list_unlink(e->count, fpn);
+          e->count++;
+          list_push(e->count, fpn);
+        }
+        ent_release(caller, fpn);
+      }
+    }
+    break;
+  case PGREPL_FIFO:
+  default:
+    break;
+  }
+
+  /* FIFO, or every page looked at was accessed: list order, the pages
+   * of a busy owner keep their place */
+  for (lists = pgrepl_nonempty; best < 0 && lists != 0; lists &= lists - 1)
+    for (fpn = pgrepl_head[__builtin_ctz(lists)]; fpn >= 0;
+         fpn = pgrepl_ent[fpn].next)
+      if (ent_claim(caller, fpn))
+      {
+        best = fpn;
+        break;
+      }
+  pthread_mutex_unlock(&pgrepl_lock);
+  if (best < 0)
+    return -1;
+  *retfpn = best;
+  return 0;
+}
+
+/*pgrepl_owner - find the page held by a tracked frame
+ *@fpn: MEMRAM frame
+ *@pgn: return PGN
+ *
+ * Return the owner, whose memlock must be held to use the page.
+ */
+struct pcb_t *pgrepl_owner(int fpn, int *pgn)
+{
+  *pgn = pgrepl_ent[fpn].pgn;
+  return pgrepl_ent[fpn].owner;
+}
+
+/*pgrepl_get_swap - find the swap slot kept by pgrepl_add()
+ *@fpn: MEMRAM frame of the page
+ *@swptyp: return device index
+ *@swpfpn: return frame on the device
+ *
+ * Return -1 if the page has no swap slot.
+ */
+int pgrepl_get_swap(int fpn, int *swptyp, int *swpfpn)
+{
+  struct pgrepl_ent *e = &pgrepl_ent[fpn];
+
+  if (e->swptyp < 0)
+    return -1;
+  *swptyp = e->swptyp;
+  *swpfpn = e->swpfpn;
+  return 0;
+}
+
+/*pgrepl_del - stop tracking a frame whose page is freed
+ *@fpn: MEMRAM frame
+ */
+void pgrepl_del(int fpn)
+{
+  pthread_mutex_lock(&pgrepl_lock);
+  if (pgrepl_hand == fpn)
+    pgrepl_hand = pgrepl_nr > 1 ? ring_next(fpn) : -1;
+  list_unlink(ent_list(fpn), fpn);
+  pgrepl_ent[fpn].owner = NULL;
+  pgrepl_nr--;
+  pthread_mutex_unlock(&pgrepl_lock);
+}
+
+/*pgrepl_evict - stop tracking the frame of a victim once it is out
+ *@fpn: MEMRAM frame given by pgrepl_victim()
+ */
+void pgrepl_evict(int fpn)
+{
+  pgrepl_del(fpn);
+  __atomic_fetch_add(&pgrepl_evictions, 1, __ATOMIC_RELAXED);
+}
+
+/*pgrepl_fault - account a page made resident on access
+ *@zerofill: first access of the page, nothing was read from swap
+ */
+void pgrepl_fault(int zerofill)
+{
+  __atomic_fetch_add(&pgrepl_faults, 1, __ATOMIC_RELAXED);
+  if (zerofill)
+    __atomic_fetch_add(&pgrepl_zerofills, 1, __ATOMIC_RELAXED);
+}
+
+static void attach_pte(int pgn, uint32_t *pte, void *arg)
+{
+  if (PAGING_PAGE_PRESENT(*pte) && !PAGING_PAGE_SWAPPED(*pte))
+    pgrepl_ent[PAGING_FPN(*pte)].owner = (struct pcb_t *)arg;
+}
+
+/*pgrepl_attach - give its frames back to a process read from a checkpoint
+ *@proc: process, with its page table
+ */
+void pgrepl_attach(struct pcb_t *proc)
+{
+  pgtbl_walk(proc->mm, 0, PAGING_MAX_PGN, attach_pte, proc);
+}
+
+/*pgrepl_save - write the policy figures and the frame table to a checkpoint
+ *@f: checkpoint
+ *
+ * Owners are not written, pgrepl_attach() sets them back. The accessed
+ * bits go with the page tables.
+ */
+void pgrepl_save(FILE *f)
+{
+  struct pgrepl_ent *e;
+  int fpn, end = -1;
+
+  ckpt_put(f, &pgrepl_policy, sizeof(pgrepl_policy));
+  ckpt_put(f, &pgrepl_faults, sizeof(pgrepl_faults));
+  ckpt_put(f, &pgrepl_zerofills, sizeof(pgrepl_zerofills));
+  ckpt_put(f, &pgrepl_evictions, sizeof(pgrepl_evictions));
+  ckpt_put(f, pgrepl_head, sizeof(pgrepl_head));
+  ckpt_put(f, pgrepl_tail, sizeof(pgrepl_tail));
+  ckpt_put(f, &pgrepl_nonempty, sizeof(pgrepl_nonempty));
+  ckpt_put(f, &pgrepl_nr, sizeof(pgrepl_nr));
+  ckpt_put(f, &pgrepl_hand, sizeof(pgrepl_hand));
+  /* Only the tracked frames */
+  for (fpn = 0; fpn < pgrepl_nframes; fpn++)
+  {
+    e = &pgrepl_ent[fpn];
+    if (e->owner == NULL)
+      continue;
+    ckpt_put(f, &fpn, sizeof(fpn));
+    ckpt_put(f, &e->pgn, sizeof(e->pgn));
+    ckpt_put(f, &e->prev, sizeof(e->prev));
+    ckpt_put(f, &e->next, sizeof(e->next));
+    ckpt_put(f, &e->count, sizeof(e->count));
+    ckpt_put(f, &e->age, sizeof(e->age));
+    ckpt_put(f, &e->swptyp, sizeof(e->swptyp));
+    ckpt_put(f, &e->swpfpn, sizeof(e->swpfpn));
+  }
+  ckpt_put(f, &end, sizeof(end));
+}
+
+/*pgrepl_load - read back what pgrepl_save() wrote
+ *@f: checkpoint
+ *
+ * The lists are laid out for the policy they were saved with, it wins
+ * over the one of the configure file.
+ */
+void pgrepl_load(FILE *f)
+{
+  struct pgrepl_ent *e;
+  int fpn;
+
+  ckpt_get(f, &pgrepl_policy, sizeof(pgrepl_policy));
+  ckpt_get(f, &pgrepl_faults, sizeof(pgrepl_faults));
+  ckpt_get(f, &pgrepl_zerofills, sizeof(pgrepl_zerofills));
+  ckpt_get(f, &pgrepl_evictions, sizeof(pgrepl_evictions));
+  ckpt_get(f, pgrepl_head, sizeof(pgrepl_head));
+  ckpt_get(f, pgrepl_tail, sizeof(pgrepl_tail));
+  ckpt_get(f, &pgrepl_nonempty, sizeof(pgrepl_nonempty));
+  ckpt_get(f, &pgrepl_nr, sizeof(pgrepl_nr));
+  ckpt_get(f, &pgrepl_hand, sizeof(pgrepl_hand));
+  for (;;)
+  {
+    ckpt_get(f, &fpn, sizeof(fpn));
+    if (fpn < 0)
+      break;
+    if (fpn >= pgrepl_nframes)
+    {
+      printf("Cannot restore the frame table\n");
+      exit(1);
+    }
+    e = &pgrepl_ent[fpn];
+    ckpt_get(f, &e->pgn, sizeof(e->pgn));
+    ckpt_get(f, &e->prev, sizeof(e->prev));
+    ckpt_get(f, &e->next, sizeof(e->next));
+    ckpt_get(f, &e->count, sizeof(e->count));
+    ckpt_get(f, &e->age, sizeof(e->age));
+    ckpt_get(f, &e->swptyp, sizeof(e->swptyp));
+    ckpt_get(f, &e->swpfpn, sizeof(e->swpfpn));
+  }
+}
+
+/*pgrepl_report - print the policy figures of the whole run */
+void pgrepl_report(void)
+{
+  printf("Page replacement %s: %lu fault(s) (%lu zero-fill), %lu eviction(s)\n",
+         pgrepl_name[pgrepl_policy], pgrepl_faults, pgrepl_zerofills,
+         pgrepl_evictions);
+}
+
+//#endif
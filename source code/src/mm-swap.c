@@ -0,0 +1,214 @@
+//#ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Swap manager mm/mm-swap.c
+ *
+ * Swap slots are taken from every MEMSWP device of a non-zero size.
+ * Devices are grouped by priority: a slot comes from the highest
+ * priority group with a free frame, the devices of a group take turns
+ * so that consecutive pages are striped over all of them. The device
+ * index goes in the SWPTYP field of the PTE of the swapped page.
+ *
+ * A page read back keeps its slot as long as it is resident: evicted
+ * again while clean, it needs no copy, and once dirty it is written
+ * over its old copy.
+ */
+
+#include "mm.h"
+#include "ckpt.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+struct swap_dev_t {
+  struct memphy_struct *mp; /* NULL if the device has no frame */
+  int prio;
+  unsigned long nr_out;     /* Pages written */
+  unsigned long nr_in;      /* Pages read back */
+};
+
+static struct swap_dev_t swap_devs[PAGING_MAX_MMSWP];
+static int swap_next; /* Device the next turn starts from */
+static unsigned long swap_saved; /* Evictions which needed no copy */
+
+/*swap_set_prio - set the priority of a device before swap_init()
+ *@swptyp: device index
+ *@prio: priority, higher is used first
+ */
+int swap_set_prio(int swptyp, int prio)
+{
+  if (swptyp < 0 || swptyp >= PAGING_MAX_MMSWP)
+    return -1;
+  swap_devs[swptyp].prio = prio;
+  return 0;
+}
+
+/*swap_init - register the MEMSWP devices
+ *@mswp: devices, indexed by swap type
+ *@n: number of devices
+ */
+void swap_init(struct memphy_struct **mswp, int n)
+{
+  int i;
+
+  for (i = 0; i < n && i < PAGING_MAX_MMSWP; i++)
+    swap_devs[i].mp = mswp[i]->maxsz >= PAGING_PAGESZ ? mswp[i] : NULL;
+}
+
+/*swap_pick - take a free frame from the best device
+ *@swptyp: return device index
+ *@swpfpn: return frame
+ *
+ * Return -1 if every device is full.
+ */
+static int swap_pick(int *swptyp, int *swpfpn)
+{
+  struct swap_dev_t *dev;
+  unsigned int tried = 0;
+  int i, k, start, top, ret;
+
+  start = __atomic_load_n(&swap_next, __ATOMIC_RELAXED);
+  for (;;)
+  {
+    /* Highest priority among the devices not found full yet */
+    top = -1;
+    for (i = 0; i < PAGING_MAX_MMSWP; i++)
+      if (swap_devs[i].mp != NULL && !(tried & BIT(i)) &&
+          (top < 0 || swap_devs[i].prio > swap_devs[top].prio))
+        top = i;
+    if (top < 0)
+      return -1;
+
+    /* Its group takes turns from the last device used */
+    for (k = 0; k < PAGING_MAX_MMSWP; k++)
+    {
+      i = (start + k) % PAGING_MAX_MMSWP;
+      dev = &swap_devs[i];
+      if (dev->mp == NULL || (tried & BIT(i)) ||
+          dev->prio != swap_devs[top].prio)
+        continue;
+
+      sem_wait(&dev->mp->memphylock);
+      ret = MEMPHY_get_freefp(dev->mp, swpfpn);
+      sem_post(&dev->mp->memphylock);
+      if (ret == 0)
+      {
+        __atomic_store_n(&swap_next, (i + 1) % PAGING_MAX_MMSWP,
+                         __ATOMIC_RELAXED);
+        *swptyp = i;
+        return 0;
+      }
+      tried |= BIT(i);
+    }
+  }
+}
+
+/*swap_out - write a MEMRAM frame to swap
+ *@mram: MEMRAM
+ *@fpn: frame written, owned by the caller
+ *@swptyp: device index of the old copy of the page, -1 to take a new
+ *         slot, return device index
+ *@swpfpn: frame of the old copy, return frame on the device
+ *
+ * Return -1 if no swap slot is left.
+ */
+int swap_out(struct memphy_struct *mram, int fpn, int *swptyp, int *swpfpn)
+{
+  if (*swptyp < 0 && swap_pick(swptyp, swpfpn) != 0)
+    return -1;
+
+  /* The slot is ours alone, the copy needs no lock */
+  __swap_cp_page(mram, fpn, swap_devs[*swptyp].mp, *swpfpn);
+  __atomic_fetch_add(&swap_devs[*swptyp].nr_out, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*swap_in - read a swap slot back to a MEMRAM frame
+ *@swptyp: device index, from the PTE
+ *@swpfpn: frame on the device, from the PTE
+ *@mram: MEMRAM
+ *@fpn: frame read into, owned by the caller
+ *
+ * The slot stays allocated, the caller gives it back with swap_free().
+ */
+int swap_in(int swptyp, int swpfpn, struct memphy_struct *mram, int fpn)
+{
+  struct swap_dev_t *dev;
+
+  if (swptyp < 0 || swptyp >= PAGING_MAX_MMSWP || swap_devs[swptyp].mp == NULL)
+    return -1;
+  dev = &swap_devs[swptyp];
+
+  __swap_cp_page(dev->mp, swpfpn, mram, fpn);
+  __atomic_fetch_add(&dev->nr_in, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*swap_free - give a swap slot back to its device
+ *@swptyp: device index
+ *@swpfpn: frame on the device
+ */
+void swap_free(int swptyp, int swpfpn)
+{
+  struct swap_dev_t *dev;
+
+  if (swptyp < 0 || swptyp >= PAGING_MAX_MMSWP || swap_devs[swptyp].mp == NULL)
+    return;
+  dev = &swap_devs[swptyp];
+
+  sem_wait(&dev->mp->memphylock);
+  MEMPHY_put_freefp(dev->mp, swpfpn);
+  sem_post(&dev->mp->memphylock);
+}
+
+/*swap_skip - account an eviction which needed no copy */
+void swap_skip(void)
+{
+  __atomic_fetch_add(&swap_saved, 1, __ATOMIC_RELAXED);
+}
+
+/*swap_save - write the swap figures to a checkpoint
+ *@f: checkpoint
+ */
+void swap_save(FILE *f)
+{
+  int i;
+
+  ckpt_put(f, &swap_next, sizeof(swap_next));
+  ckpt_put(f, &swap_saved, sizeof(swap_saved));
+  for (i = 0; i < PAGING_MAX_MMSWP; i++)
+  {
+    ckpt_put(f, &swap_devs[i].nr_out, sizeof(swap_devs[i].nr_out));
+    ckpt_put(f, &swap_devs[i].nr_in, sizeof(swap_devs[i].nr_in));
+  }
+}
+
+/*swap_load - read back what swap_save() wrote
+ *@f: checkpoint
+ */
+void swap_load(FILE *f)
+{
+  int i;
+
+  ckpt_get(f, &swap_next, sizeof(swap_next));
+  ckpt_get(f, &swap_saved, sizeof(swap_saved));
+  for (i = 0; i < PAGING_MAX_MMSWP; i++)
+  {
+    ckpt_get(f, &swap_devs[i].nr_out, sizeof(swap_devs[i].nr_out));
+    ckpt_get(f, &swap_devs[i].nr_in, sizeof(swap_devs[i].nr_in));
+  }
+}
+
+/*swap_report - print the use of every device over the whole run */
+void swap_report(void)
+{
+  int i;
+
+  for (i = 0; i < PAGING_MAX_MMSWP; i++)
+    if (swap_devs[i].mp != NULL)
+      printf("Swap device %d: priority %d, %d frames, %lu page(s) out, %lu page(s) in\n",
+             i, swap_devs[i].prio, swap_devs[i].mp->maxsz / PAGING_PAGESZ,
+             swap_devs[i].nr_out, swap_devs[i].nr_in);
+  printf("Swap: %lu page copy(ies) saved by clean evictions\n", swap_saved);
+}
+
+//#endif
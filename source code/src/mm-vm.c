@@ -14,26 +14,12 @@
  *@mm: memory region
  *@rg_elmt: new region
  *
+ * The region is merged with the free ones it touches. Caller holds
+ * mm->memlock.
  */
 int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct rg_elmt)
 {
-  sem_wait(&mm->memlock);
-  struct vm_rg_struct * rg_clone_pointer = malloc(sizeof(struct vm_rg_struct));
-  *rg_clone_pointer = rg_elmt;
-  struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
-
-  if (rg_elmt.rg_start >= rg_elmt.rg_end){
-    sem_post(&mm->memlock);
-    return -1;
-  }
-
-  if (rg_node != NULL)
-    rg_clone_pointer->rg_next = rg_node;
-
-  /* Enlist the new region */
-  mm->mmap->vm_freerg_list =  rg_clone_pointer;
-  sem_post(&mm->memlock);
-  return 0;
+  return freerg_insert(&mm->mmap->vm_freerg, rg_elmt.rg_start, rg_elmt.rg_end);
 }
 
 /*get_vma_by_num - get vm area by numID
@@ -114,6 +100,7 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
    */
   cur_vma->sbrk += inc_sz;
   if(inc_vma_limit(caller, vmaid, inc_sz)){
+    cur_vma->sbrk = old_sbrk;
     printf("Increase limit failed\n");
     sem_post(&caller->mm->memlock);
     return -1;
@@ -123,19 +110,10 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
   caller->mm->symrgtbl[rgid].rg_start = old_sbrk;
   caller->mm->symrgtbl[rgid].rg_end = old_sbrk + size;
   
-  //Update the freerg list
-  if(cur_vma->vm_freerg_list->rg_start >= cur_vma->vm_freerg_list->rg_end){
-    cur_vma->vm_freerg_list->rg_start = old_sbrk + size;
-    cur_vma->vm_freerg_list->rg_end = cur_vma->sbrk;
-    sem_post(&caller->mm->memlock);
-  }
-  else{
-    //Traverse to the end
-    struct vm_rg_struct rg_elmt_pointer;
-    rg_elmt_pointer.rg_start = old_sbrk + size;
-    rg_elmt_pointer.rg_end = cur_vma->sbrk;
-    enlist_vm_freerg_list(caller->mm, rg_elmt_pointer);
-  }
+  /* The rest of the last page is free, nothing if size is aligned */
+  rgnode.rg_start = old_sbrk + size;
+  rgnode.rg_end = cur_vma->sbrk;
+  enlist_vm_freerg_list(caller->mm, rgnode);
   sem_post(&caller->mm->memlock);
   *alloc_addr = old_sbrk;
   return 0;
@@ -151,20 +129,12 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
  int check_if_in_freerg_list(struct pcb_t *caller, int vmaid, struct vm_rg_struct *currg) {
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
-  struct vm_rg_struct *rgit = cur_vma->vm_freerg_list;
-
-  if (rgit == NULL)
-    return 1;
-
-  /* Traverse on list of free vm region to find a fit space */
-  while (rgit != NULL)
-  {
-    if (rgit->rg_start == currg->rg_start && rgit->rg_end == currg->rg_end)
-    {
-      return -1;
-    }
-    rgit = rgit->rg_next;	// Traverse next rg
-  }
+  /* A freed symbol is emptied, its range may since be merged into a
+   * larger free region or handed to another symbol */
+  if (currg->rg_start >= currg->rg_end)
+    return -1;
+  if (freerg_lookup(&cur_vma->vm_freerg, currg->rg_start) != NULL)
+    return -1;
   return 1;
 }
 
@@ -179,12 +149,11 @@ int __free(struct pcb_t *caller, int vmaid, int rgid)
   }
    
 
-  /* TODO: Manage the collect freed region to freerg_list */
   caller->mm->symrgtbl[rgid].rg_start = 0;
   caller->mm->symrgtbl[rgid].rg_end = 0;
-  /*enlist the obsoleted memory region */
-  sem_post(&caller->mm->memlock);
+  /*enlist the obsoleted memory region, merged with its neighbours */
   enlist_vm_freerg_list(caller->mm, rgnode);
+  sem_post(&caller->mm->memlock);
   printf("--->Free finished\n");
   return 0;
 }
@@ -213,58 +182,130 @@ int pgfree_data(struct pcb_t *proc, uint32_t reg_index)
    return __free(proc, 0, reg_index);
 }
 
+/*pg_evict - move a resident page out to swap
+ *@caller: caller, holding its memlock
+ *@retfpn: return the MEMRAM frame given up
+ *
+ * The victim may belong to any process, see pgrepl_victim(). A dirty
+ * page is written to swap, over the copy it was read from if it has
+ * one, see swap_out(). A clean page is not copied: its swap copy is
+ * still valid, or, if it never had one, it holds nothing but the zeros
+ * of its first access and is only reserved again. Return -1 if no page
+ * can be evicted or the swap is full.
+ */
+int pg_evict(struct pcb_t *caller, int *retfpn)
+{
+  struct pcb_t *owner;
+  uint32_t *pte;
+  int vicpgn, vicfpn, swpfpn, swptyp;
+
+  if (find_victim_page(caller, &vicfpn) != 0)
+    return -1;
+  /* The memlock of the owner is held from here */
+  owner = pgrepl_owner(vicfpn, &vicpgn);
+  pte = pgtbl_lookup(owner->mm, vicpgn);
+  if (pgrepl_get_swap(vicfpn, &swptyp, &swpfpn) != 0)
+    swptyp = -1;
+
+  if (PAGING_PAGE_DIRTY(*pte))
+  {
+    /* Copy victim frame to swap */
+    if (swap_out(caller->mram, vicfpn, &swptyp, &swpfpn) != 0)
+    {
+      /* Stays resident, its entry untouched */
+      if (owner->mm != caller->mm)
+        sem_post(&owner->mm->memlock);
+      return -1;
+    }
+  } else {
+    swap_skip();
+  }
+
+  if (swptyp < 0)
+  {
+    *pte = PAGING_PTE_RESERVE_MASK;
+  } else {
+    *pte = 0;
+    pte_set_swap(pte, swptyp, swpfpn);
+  }
+#ifdef CPU_TLB
+  tlb_clear_bit_valid(owner->tlb, owner->pid, vicpgn);
+#endif
+  pgrepl_evict(vicfpn);
+  if (owner->mm != caller->mm)
+    sem_post(&owner->mm->memlock);
+  *retfpn = vicfpn;
+  return 0;
+}
+
+/*pg_setdirty - mark a resident page written
+ *@mm: memory region
+ *@pgn: PGN
+ *
+ * Its swap copy, if any, is stale from now on.
+ */
+void pg_setdirty(struct mm_struct *mm, int pgn)
+{
+  uint32_t *pte = pgtbl_lookup(mm, pgn);
+
+  if (pte != NULL && PAGING_PAGE_PRESENT(*pte) && !PAGING_PAGE_SWAPPED(*pte))
+    SETBIT(*pte, PAGING_PTE_DIRTY_MASK);
+}
+
 /*pg_getpage - get the page in ram
  *@mm: memory region
  *@pagenum: PGN
  *@framenum: return FPN
  *@caller: caller
  *
+ * A page reserved and never accessed gets a zeroed frame, a swapped
+ * page is brought back. The frame is a free one of MEMRAM or the frame
+ * of a victim chosen by the page replacement policy. The caller holds
+ * mm->memlock. Return -1 for a page outside the heap or if no frame can
+ * be found.
  */
 int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
 {
-  uint32_t pte = mm->pgd[pgn];
-    
-  if (!PAGING_PAGE_PRESENT(pte))
-  { /* Page is not online, make it actively living */
-    
-    int vicpgn, swpfpn; 
-    int vicfpn;
-    uint32_t vicpte;
-
-    int tgtfpn = PAGING_SWP(pte);//the target frame storing our variable
-
-    /* TODO: Play with your paging theory here */
-    /* Find victim page */
-    find_victim_page(caller->mm, &vicpgn);
-    
-    /* Get free frame in MEMSWP */
-    MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
+  uint32_t *pte = pgtbl_lookup(mm, pgn);
+  int tgtfpn, swptyp, swpfpn = 0, ret, i;
 
-    vicpte = caller->mm->pgd[vicpgn];
-    vicfpn = PAGING_FPN(vicpgn);
+  if (pte == NULL ||
+      !(*pte & (PAGING_PTE_PRESENT_MASK | PAGING_PTE_RESERVE_MASK)))
+    return -1; /* invalid page access */
 
-    /* Do swap frame from MEMRAM to MEMSWP and vice versa*/
-    /* Copy victim frame to swap */
-    printf("Start swapping\n");
+  if (!PAGING_PAGE_PRESENT(*pte) || PAGING_PAGE_SWAPPED(*pte))
+  { /* Page is not online, make it actively living */
     sem_wait(&caller->mram->memphylock);
-    __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
-    
-    /* Copy target frame from swap to mem */
-   __swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, vicfpn);
-    
+    ret = MEMPHY_get_freefp(caller->mram, &tgtfpn);
+    sem_post(&caller->mram->memphylock);
+    if (ret != 0 && pg_evict(caller, &tgtfpn) != 0)
+      return -1;
 
-    /* Update page table */
-    pte_set_swap(&vicpte, 1,0);
+    swptyp = -1;
+    if (PAGING_PAGE_PRESENT(*pte))
+    {
+      /* Copy target frame from swap to mem, the slot is kept as a swap
+       * cache until the page is written */
+      swptyp = PAGING_SWPTYP(*pte);
+      swpfpn = PAGING_SWP(*pte);
+      swap_in(swptyp, swpfpn, caller->mram, tgtfpn);
+      pgrepl_fault(0);
+    } else {
+      /* First access, the frame still holds data of its last owner */
+      for (i = 0; i < PAGING_PAGESZ; i++)
+        MEMPHY_write(caller->mram, tgtfpn * PAGING_PAGESZ + i, 0);
+      pgrepl_fault(1);
+    }
 
     /* Update its online status of the target page */
-    //pte_set_fpn() & mm->pgd[pgn];
-    pte_set_fpn(&pte, tgtfpn);
-
-    enlist_pgn_node(&caller->mm->fifo_pgn,pgn);
-    sem_post(&caller->mram->memphylock);
+    *pte = 0;
+    pte_set_fpn(pte, tgtfpn);
+    pgrepl_add(caller, pgn, tgtfpn, swptyp, swpfpn);
+  } else {
+    /* Read and cleared by the replacement policy, see mm-pgrepl.c */
+    SETBIT(*pte, PAGING_PTE_ACCESSED_MASK);
   }
-  *fpn = PAGING_FPN(pte);
-  printf("--->Swap finished\n");
+  *fpn = PAGING_FPN(*pte);
   return 0;
 }
 
@@ -273,6 +314,7 @@ int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
  *@addr: virtual address to acess 
  *@value: value
  *
+ * The caller holds mm->memlock.
  */
 int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
 {
@@ -296,6 +338,7 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
  *@addr: virtual address to acess 
  *@value: value
  *
+ * The caller holds mm->memlock.
  */
 int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
 {
@@ -310,6 +353,7 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
   int phyaddr = (fpn << PAGING_ADDR_FPN_LOBIT) + off;
 
   MEMPHY_write(caller->mram,phyaddr, value);
+  pg_setdirty(mm, pgn);
 
    return 0;
 }
@@ -321,19 +365,23 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
  *@rgid: memory region ID (used to identify variable in symbole table)
  *@size: allocated size 
  *
+ * Return -1 if the page cannot be brought in, see pg_getpage().
  */
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data)
 {
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+  int ret;
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
   if(currg == NULL || cur_vma == NULL) /* Invalid memory identify */
 	  return -1;
 
-  pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  sem_wait(&caller->mm->memlock);
+  ret = pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  sem_post(&caller->mm->memlock);
 
-  return 0;
+  return ret;
 }
 
 
@@ -347,6 +395,11 @@ int pgread(
   BYTE data;
   int val = __read(proc, 0, source, offset, &data);
 
+  if (val != 0)
+  {
+    printf("*read region=%d offset=%d failed\n", source, offset);
+    return val;
+  }
   destination = (uint32_t) data;
 #ifdef IODUMP
   printf("*read region=%d offset=%d value=%d\n\n", source, offset, data);
@@ -366,19 +419,23 @@ int pgread(
  *@rgid: memory region ID (used to identify variable in symbole table)
  *@size: allocated size 
  *
+ * Return -1 if the page cannot be brought in, see pg_getpage().
  */
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value)
 {
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+  int ret;
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
   
   if(currg == NULL || cur_vma == NULL) /* Invalid memory identify */
 	  return -1;
 
-  pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+  sem_wait(&caller->mm->memlock);
+  ret = pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+  sem_post(&caller->mm->memlock);
 
-  return 0;
+  return ret;
 }
 
 /*pgwrite - PAGING-based write a region memory */
@@ -396,34 +453,207 @@ int pgwrite(
   MEMPHY_dump(proc->mram);
 #endif
 
-  return __write(proc, 0, destination, offset, data);
+  int val = __write(proc, 0, destination, offset, data);
+
+  if (val != 0)
+    printf("*write region=%d offset=%d failed\n", destination, offset);
+  return val;
 }
 
+/*pg_translate - default page translation of __copy()/__fill()
+ *@caller: caller
+ *@pgn: PGN
+ *@fpn: return FPN
+ *
+ */
+static int pg_translate(struct pcb_t *caller, int pgn, int *fpn)
+{
+  return pg_getpage(caller->mm, pgn, fpn, caller);
+}
 
-/*free_pcb_memphy - collect all memphy of pcb
+/*__copy - copy the first bytes of a region memory to another one
  *@caller: caller
- *@vmaid: ID vm area to alloc memory region
- *@incpgnum: number of page
+ *@vmaid: ID vm area the regions belong to
+ *@srcrg: source memory region ID
+ *@dstrg: destination memory region ID
+ *@len: number of bytes to copy
+ *@translate: page translation, NULL to use pg_getpage()
+ *
+ * The copy goes by chunks which do not cross a page of either region,
+ * each chunk translates its pages once and then accesses MEMRAM
+ * directly instead of translating every byte. [translate] is called
+ * with mm->memlock held.
  */
-int free_pcb_memph(struct pcb_t *caller)
+int __copy(struct pcb_t *caller, int vmaid, int srcrg, int dstrg, int len,
+           pg_translate_t translate)
 {
-  int pagenum, fpn;
-  uint32_t pte;
+  struct vm_rg_struct *src = get_symrg_byid(caller->mm, srcrg);
+  struct vm_rg_struct *dst = get_symrg_byid(caller->mm, dstrg);
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  BYTE buf[PAGING_PAGESZ];
+  int saddr, daddr, sfpn, dfpn, chunk, i;
 
+  if(src == NULL || dst == NULL || cur_vma == NULL) /* Invalid memory identify */
+    return -1;
+  if(len < 0 || len > src->rg_end - src->rg_start ||
+     len > dst->rg_end - dst->rg_start)
+    return -1;
+  if(translate == NULL)
+    translate = pg_translate;
 
-  for(pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
+  saddr = src->rg_start;
+  daddr = dst->rg_start;
+  sem_wait(&caller->mm->memlock);
+  while(len > 0)
   {
-    pte= caller->mm->pgd[pagenum];
+    chunk = PAGING_PAGESZ - PAGING_OFFST(saddr);
+    if(chunk > PAGING_PAGESZ - PAGING_OFFST(daddr))
+      chunk = PAGING_PAGESZ - PAGING_OFFST(daddr);
+    if(chunk > len)
+      chunk = len;
+
+    /* Bring the destination in only once the source is buffered, it
+     * may take the frame of the source page */
+    if(translate(caller, PAGING_PGN(saddr), &sfpn) != 0)
+      break;
+    for(i = 0; i < chunk; i++)
+      MEMPHY_read(caller->mram,
+          (sfpn << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(saddr) + i, &buf[i]);
+    if(translate(caller, PAGING_PGN(daddr), &dfpn) != 0)
+      break;
+    pg_setdirty(caller->mm, PAGING_PGN(daddr));
+    for(i = 0; i < chunk; i++)
+      MEMPHY_write(caller->mram,
+          (dfpn << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(daddr) + i, buf[i]);
+
+    saddr += chunk;
+    daddr += chunk;
+    len -= chunk;
+  }
+  sem_post(&caller->mm->memlock);
 
-    if (!PAGING_PAGE_PRESENT(pte))
-    {
-      fpn = PAGING_FPN(pte);
-      MEMPHY_put_freefp(caller->mram, fpn);
-    } else {
-      fpn = PAGING_SWP(pte);
-      MEMPHY_put_freefp(caller->active_mswp, fpn);    
-    }
+  return len > 0 ? -1 : 0;
+}
+
+/*__fill - set the first bytes of a region memory to a value
+ *@caller: caller
+ *@vmaid: ID vm area the region belongs to
+ *@rgid: memory region ID
+ *@value: value written
+ *@len: number of bytes to set
+ *@translate: page translation, NULL to use pg_getpage()
+ *
+ */
+int __fill(struct pcb_t *caller, int vmaid, int rgid, BYTE value, int len,
+           pg_translate_t translate)
+{
+  struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  int addr, fpn, chunk, i;
+
+  if(currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+    return -1;
+  if(len < 0 || len > currg->rg_end - currg->rg_start)
+    return -1;
+  if(translate == NULL)
+    translate = pg_translate;
+
+  sem_wait(&caller->mm->memlock);
+  for(addr = currg->rg_start; len > 0; addr += chunk, len -= chunk)
+  {
+    chunk = PAGING_PAGESZ - PAGING_OFFST(addr);
+    if(chunk > len)
+      chunk = len;
+
+    if(translate(caller, PAGING_PGN(addr), &fpn) != 0)
+      break;
+    pg_setdirty(caller->mm, PAGING_PGN(addr));
+    for(i = 0; i < chunk; i++)
+      MEMPHY_write(caller->mram,
+          (fpn << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(addr) + i, value);
   }
+  sem_post(&caller->mm->memlock);
+
+  return len > 0 ? -1 : 0;
+}
+
+/*pgcopy - PAGING-based copy a region memory to another one */
+int pgcopy(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t source, // Index of source register
+		uint32_t destination, // Index of destination register
+		uint32_t len) // Number of bytes to copy
+{
+  int val = __copy(proc, 0, source, destination, len, NULL);
+
+#ifdef IODUMP
+  printf("*copy region=%d to region=%d len=%d\n\n", source, destination, len);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return val;
+}
+
+/*pgfill - PAGING-based fill a region memory with a value */
+int pgfill(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t destination, // Index of destination register
+		BYTE data, // Data to be written into memory
+		uint32_t len) // Number of bytes to set
+{
+  int val = __fill(proc, 0, destination, data, len, NULL);
+
+#ifdef IODUMP
+  printf("*fill region=%d value=%d len=%d\n\n", destination, data, len);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return val;
+}
+
+
+/*free_pte_frame - give the frame of a page back to its device */
+static void free_pte_frame(int pgn, uint32_t *pte, void *arg)
+{
+  struct pcb_t *caller = (struct pcb_t *)arg;
+  int fpn, swptyp, swpfpn;
+
+  if (PAGING_PAGE_PRESENT(*pte) && PAGING_PAGE_SWAPPED(*pte))
+  {
+    swap_free(PAGING_SWPTYP(*pte), PAGING_SWP(*pte));
+  } else if (PAGING_PAGE_PRESENT(*pte)) {
+    fpn = PAGING_FPN(*pte);
+    if (pgrepl_get_swap(fpn, &swptyp, &swpfpn) == 0)
+      swap_free(swptyp, swpfpn); /* Its swap cache */
+    /* Untracked before it is free, a fault may take it right away */
+    pgrepl_del(fpn);
+    sem_wait(&caller->mram->memphylock);
+    MEMPHY_put_freefp(caller->mram, fpn);
+    sem_post(&caller->mram->memphylock);
+  }
+  /* Reserved pages never accessed have no frame */
+  *pte = 0;
+}
+
+/*free_pcb_memphy - collect all memphy of pcb
+ *@caller: caller
+ *
+ * Every mapped page goes back to the free list of the device it lives
+ * on, MEMRAM or the MEMSWP given by its swap type, and its PTE is
+ * cleared. Only the populated parts of the page table are visited. The
+ * memlock keeps the pages from being evicted meanwhile.
+ */
+int free_pcb_memph(struct pcb_t *caller)
+{
+  sem_wait(&caller->mm->memlock);
+  pgtbl_walk(caller->mm, 0, PAGING_MAX_PGN, free_pte_frame, caller);
+  sem_post(&caller->mm->memlock);
 
   return 0;
 }
@@ -489,56 +719,37 @@ int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
 
   /*Validate overlap of obtained region */
   if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0){
-    sem_post(&caller->mram->memphylock);
+    free(area);
+    free(newrg);
     return -1; /*Overlap and failed allocation */
   }
     
 
-  /* The obtained vm area (only) 
-   * now will be alloc real ram region */
-  
-  sem_wait(&caller->mram->memphylock);
-  if (vm_map_ram(caller, area->rg_start, area->rg_end, old_end, incnumpage , newrg) < 0)
+  /* The obtained vm area (only) is reserved, its pages get a frame
+   * of MEMRAM on their first access, see pg_getpage() */
+  if (vmap_page_reserve(caller, old_end, incnumpage) < 0)
   {
-    sem_post(&caller->mram->memphylock);
+    free(area);
+    free(newrg);
     return -1;
   }
   cur_vma->vm_end += inc_sz;
-    /* Map the memory to MEMRAM */
-  sem_post(&caller->mram->memphylock);
+  free(area);
+  free(newrg);
   return 0;
 
 }
 
 /*find_victim_page - find victim page
  *@caller: caller
- *@pgn: return page number
+ *@fpn: return MEMRAM frame of the victim
  *
+ * The victim is chosen among the pages of every process by the policy
+ * of pgrepl_set_policy(), its owner is held until pgrepl_evict().
  */
-int find_victim_page(struct mm_struct *mm, int *retpgn) 
+int find_victim_page(struct pcb_t *caller, int *retfpn)
 {
-  struct pgn_t *pg = mm->fifo_pgn;
-  
-  /* TODO: Implement the theorical mechanism to find the victim page */
-    if (!pg) return -1;
-    
-    if(!pg->pg_next)
-    {
-      *retpgn = pg->pgn;
-      mm->fifo_pgn = NULL;
-      free(pg);
-    }
-    else
-    {
-        while(pg->pg_next->pg_next)
-        { 
-        pg = pg->pg_next;
-        }
-        *retpgn = pg->pg_next->pgn;
-        free(pg->pg_next);
-        pg->pg_next = NULL;
-    }
-    return 0;
+  return pgrepl_victim(caller, retfpn);
 }
 
 /*get_free_vmrg_area - get a free vm region
@@ -546,65 +757,16 @@ int find_victim_page(struct mm_struct *mm, int *retpgn)
  *@vmaid: ID vm area to alloc memory region
  *@size: allocated size 
  *
+ * Best fit: the smallest free region large enough, see freerg_take().
  */
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg)
 {
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
-  struct vm_rg_struct *rgit = cur_vma->vm_freerg_list;
-
-  if (rgit == NULL)
+  if (cur_vma == NULL || size < 0)
     return -1;
 
-  /* Probe unintialized newrg */
-  newrg->rg_start = newrg->rg_end = -1;
-
-  /* Traverse on list of free vm region to find a fit space */
-  while (rgit != NULL)
-  {
-    if (rgit->rg_start + size <= rgit->rg_end)
-    { /* Current region has enough space */
-      newrg->rg_start = rgit->rg_start;
-      newrg->rg_end = rgit->rg_start + size;
-
-      /* Update left space in chosen region */
-      if (rgit->rg_start + size < rgit->rg_end)
-      {
-        rgit->rg_start = rgit->rg_start + size;
-      }
-      else
-      { /*Use up all space, remove current node */
-        /*Clone next rg node */
-        struct vm_rg_struct *nextrg = rgit->rg_next;
-
-        /*Cloning */
-        if (nextrg != NULL)
-        {
-          rgit->rg_start = nextrg->rg_start;
-          rgit->rg_end = nextrg->rg_end;
-
-          rgit->rg_next = nextrg->rg_next;
-
-          free(nextrg);
-        }
-        else
-        { /*End of free list */
-          rgit->rg_start = rgit->rg_end;	//dummy, size 0 region
-          rgit->rg_next = NULL;
-        }
-      }
-      break;
-    }
-    else
-    {
-      rgit = rgit->rg_next;	// Traverse next rg
-    }
-  }
-
- if(newrg->rg_start == -1) // new region not found
-   return -1;
-
- return 0;
+  return freerg_take(&cur_vma->vm_freerg, size, newrg);
 }
 
 //#endif
@@ -76,119 +76,27 @@ int pte_set_fpn(uint32_t *pte, int fpn)
 }
 
 
-/* 
- * vmap_page_range - map a range of page at aligned address
- */
-int vmap_page_range(struct pcb_t *caller, // process call
-                                int addr, // start address which is aligned to pagesz
-                               int pgnum, // num of mapping page
-           struct framephy_struct *frames,// list of the mapped frames
-              struct vm_rg_struct *ret_rg)// return mapped region, the real mapped fp
-{                                         // no guarantee all given pages are mapped
-  struct framephy_struct *fpit;
-  int  fpn;
-  int pgit = 0;
-  int pgn = PAGING_PGN(addr);
-  
-  ret_rg->rg_end = ret_rg->rg_start = addr; // at least the very first space is usable
-
-  fpit = frames;
-  /* TODO map range of frame to address space 
-   *      [addr to addr + pgnum*PAGING_PAGESZ
-   *      in page table caller->mm->pgd[]
-   */
-  //printf("frames->fpn: %d\n", frames->fpn);
-  
-  uint32_t* pte = malloc(sizeof(uint32_t));
-  init_pte(pte, 1, 1, 0, 0, 0, 0);
-  for(; pgit < pgnum; pgit++){
-    fpn = fpit->fpn;
-    printf("   Free frame is: %d\n", fpn);
-    pte_set_swap(pte, 0, 0);
-    pte_set_fpn(pte, fpn);
-    caller->mm->pgd[pgn + pgit] = *pte;
-    printf("   Mapped region [%ld->",ret_rg->rg_end);
-    ret_rg->rg_end += PAGING_PAGESZ;
-    printf("%ld] to frame %d with address %08x\n",ret_rg->rg_end,fpn,*pte);
-    fpit = fpit->fp_next;
-    enlist_pgn_node(&caller->mm->fifo_pgn, pgn+pgit);  
-  }
-  free(pte);
-  caller->mram->used_fp_list = frames;
-   /* Tracking for later page replacement activities (if needed)
-    * Enqueue new usage page */
-  return 0;
-}
-
-/* 
- * alloc_pages_range - allocate req_pgnum of frame in ram
- * @caller    : caller
- * @req_pgnum : request page num
- * @frm_lst   : frame list
+/*
+ * vmap_page_reserve - reserve a range of pages at aligned address
+ * @caller : process call
+ * @addr   : start address which is aligned to pagesz
+ * @pgnum  : num of reserved pages
+ *
+ * No frame is mapped, the PTEs are only marked reserved and pg_getpage()
+ * gives each page a zeroed frame on its first access.
  */
-
-int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struct** frm_lst)
+int vmap_page_reserve(struct pcb_t *caller, int addr, int pgnum)
 {
-  int pgit, fpn;
-  struct framephy_struct *newfp_str;
-  printf("alloc_pages_range: %d\n", req_pgnum);
-  for(pgit = 0; pgit < req_pgnum; pgit++)
-  {
-    if(MEMPHY_get_freefp(caller->mram, &fpn) == 0)
-   {
-      newfp_str = malloc(sizeof(struct framephy_struct));
-      newfp_str->fpn = fpn;
-      newfp_str->fp_next = *frm_lst;
-      *frm_lst = newfp_str;
-   } 
-   else {  // ERROR CODE of obtaining somes but not enough frames
-        printf("Not enough frames \n");
-        return -3000;
-   } 
- }
-  return 0;
-}
-
+  int pgn = PAGING_PGN(addr);
+  int pgit;
 
-/* 
- * vm_map_ram - do the mapping all vm are to ram storage device
- * @caller    : caller
- * @astart    : vm area start
- * @aend      : vm area end
- * @mapstart  : start mapping point
- * @incpgnum  : number of mapped page
- * @ret_rg    : returned region
- */
-int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
-{
-  struct framephy_struct *frm_lst = caller->mram->used_fp_list;
-  int ret_alloc;
-
-  /*@bksysnet: author provides a feasible solution of getting frames
-   *FATAL logic in here, wrong behaviour if we have not enough page
-   *i.e. we request 1000 frames meanwhile our RAM has size of 3 frames
-   *Don't try to perform that case in this simple work, it will result
-   *in endless procedure of swap-off to get frame and we have not provide 
-   *duplicate control mechanism, keep it simple
-   */
-  ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
-
-  if (ret_alloc < 0 && ret_alloc != -3000)
+  /* Past the CPU bus the PGN would wrap onto mapped pages */
+  if ((uint64_t)addr + (uint64_t)pgnum * PAGING_PAGESZ > BIT(PAGING_CPU_BUS_WIDTH))
     return -1;
 
-  /* Out of memory */
-  if (ret_alloc == -3000) 
-  {
-#ifdef MMDBG
-     printf("OOM: vm_map_ram out of memory \n");
-#endif
-     return -1;
-  }
-
-  /* it leaves the case of memory is enough but half in ram, half in swap
-   * do the swaping all to swapper to get the all in ram */
-  vmap_page_range(caller, mapstart, incpgnum, frm_lst, ret_rg);
-
+  for (pgit = 0; pgit < pgnum; pgit++)
+    if (pgtbl_set(caller->mm, pgn + pgit, PAGING_PTE_RESERVE_MASK) < 0)
+      return -1;
   return 0;
 }
 
@@ -216,6 +124,135 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
   return 0;
 }
 
+/*
+ * pgtbl_lookup - find the PTE of a page
+ * @mm  : owner of the page table
+ * @pgn : page number (PGN)
+ *
+ * Return NULL if no page around [pgn] was ever mapped.
+ */
+uint32_t *pgtbl_lookup(struct mm_struct *mm, int pgn)
+{
+  void *node = mm->pgd;
+  int lvl;
+
+  for (lvl = PAGING_PTBL_LEVELS - 1; lvl > 0 && node != NULL; lvl--)
+    node = ((void **)node)[PAGING_PTBL_IDX(pgn, lvl)];
+
+  if (node == NULL)
+    return NULL;
+  return &((uint32_t *)node)[PAGING_PTBL_IDX(pgn, 0)];
+}
+
+/*
+ * pgtbl_get - read the PTE of a page, 0 if it was never mapped
+ * @mm  : owner of the page table
+ * @pgn : page number (PGN)
+ */
+uint32_t pgtbl_get(struct mm_struct *mm, int pgn)
+{
+  uint32_t *pte = pgtbl_lookup(mm, pgn);
+
+  return pte != NULL ? *pte : 0;
+}
+
+/*
+ * pgtbl_set - write the PTE of a page, allocating the missing levels
+ * @mm  : owner of the page table
+ * @pgn : page number (PGN)
+ * @pte : new page table entry (PTE)
+ */
+int pgtbl_set(struct mm_struct *mm, int pgn, uint32_t pte)
+{
+  void **slot = &mm->pgd;
+  int lvl;
+
+  for (lvl = PAGING_PTBL_LEVELS - 1; lvl >= 0; lvl--)
+  {
+    if (*slot == NULL)
+    {
+      if (pte == 0)
+        return 0; /* Clearing an entry never mapped */
+      *slot = calloc(PAGING_PTBL_FANOUT,
+                     lvl > 0 ? sizeof(void *) : sizeof(uint32_t));
+      if (*slot == NULL)
+        return -1;
+    }
+    if (lvl > 0)
+      slot = &((void **)*slot)[PAGING_PTBL_IDX(pgn, lvl)];
+  }
+
+  ((uint32_t *)*slot)[PAGING_PTBL_IDX(pgn, 0)] = pte;
+  return 0;
+}
+
+static void pgtbl_walk_node(void *node, int lvl, uint64_t base,
+                            int pgn_start, int pgn_end,
+                            pgtbl_fn_t fn, void *arg)
+{
+  uint64_t span = (uint64_t)1 << (lvl * PAGING_PTBL_BITS);
+  uint64_t child;
+  int i;
+
+  for (i = 0; i < PAGING_PTBL_FANOUT; i++)
+  {
+    child = base + i * span;
+    if (child + span <= (uint64_t)pgn_start)
+      continue;
+    if (child >= (uint64_t)pgn_end)
+      break;
+
+    if (lvl == 0)
+    {
+      if (((uint32_t *)node)[i] != 0)
+        fn((int)child, &((uint32_t *)node)[i], arg);
+    }
+    else if (((void **)node)[i] != NULL)
+      pgtbl_walk_node(((void **)node)[i], lvl - 1, child,
+                      pgn_start, pgn_end, fn, arg);
+  }
+}
+
+/*
+ * pgtbl_walk - call fn on every mapped PTE of a range of pages, in order
+ * @mm        : owner of the page table
+ * @pgn_start : first page number of the range
+ * @pgn_end   : page number past the range
+ * @fn        : callback, gets the PGN and a pointer to its PTE
+ * @arg       : passed to fn
+ *
+ * Subtrees never populated are skipped as a whole.
+ */
+void pgtbl_walk(struct mm_struct *mm, int pgn_start, int pgn_end,
+                pgtbl_fn_t fn, void *arg)
+{
+  if (mm->pgd != NULL)
+    pgtbl_walk_node(mm->pgd, PAGING_PTBL_LEVELS - 1, 0,
+                    pgn_start, pgn_end, fn, arg);
+}
+
+static void pgtbl_free_node(void *node, int lvl)
+{
+  int i;
+
+  if (lvl > 0)
+    for (i = 0; i < PAGING_PTBL_FANOUT; i++)
+      if (((void **)node)[i] != NULL)
+        pgtbl_free_node(((void **)node)[i], lvl - 1);
+  free(node);
+}
+
+/*
+ * pgtbl_free - release every level of a page table
+ * @mm : owner of the page table
+ */
+void pgtbl_free(struct mm_struct *mm)
+{
+  if (mm->pgd != NULL)
+    pgtbl_free_node(mm->pgd, PAGING_PTBL_LEVELS - 1);
+  mm->pgd = NULL;
+}
+
 /*
  *Initialize a empty Memory Management instance
  * @mm:     self mm
@@ -223,17 +260,17 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
  */
 int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
-  struct vm_area_struct * vma = malloc(sizeof(struct vm_area_struct));
+  struct vm_area_struct * vma = calloc(1, sizeof(struct vm_area_struct));
 
-  mm->pgd = malloc(PAGING_MAX_PGN*sizeof(uint32_t));
+  /* Nothing is mapped yet, the page table grows with the mappings */
+  mm->pgd = NULL;
 
   /* By default the owner comes with at least one vma */
   vma->vm_id = 1;
   vma->vm_start = 0;
   vma->vm_end = vma->vm_start;
   vma->sbrk = vma->vm_start;
-  struct vm_rg_struct *first_rg = init_vm_rg(vma->vm_start, vma->vm_end);
-  enlist_vm_rg_node(&vma->vm_freerg_list, first_rg);
+  freerg_init(&vma->vm_freerg);
 
   vma->vm_next = NULL;
   vma->vm_mm = mm; /*point back to vma owner */
@@ -243,6 +280,27 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
   return 0;
 }
 
+/*
+ *Release a Memory Management instance, its frames must have been
+ *given back with free_pcb_memph() first
+ * @mm:     self mm
+ */
+void free_mm(struct mm_struct *mm)
+{
+  struct vm_area_struct *vma;
+
+  while ((vma = mm->mmap) != NULL)
+  {
+    mm->mmap = vma->vm_next;
+    freerg_free(&vma->vm_freerg);
+    free(vma);
+  }
+
+  pgtbl_free(mm);
+  sem_destroy(&mm->memlock);
+  free(mm);
+}
+
 struct vm_rg_struct* init_vm_rg(int rg_start, int rg_end)
 {
   struct vm_rg_struct *rgnode = malloc(sizeof(struct vm_rg_struct));
@@ -335,10 +393,14 @@ int print_list_pgn(struct pgn_t *ip)
    return 0;
 }
 
+static void print_pte(int pgn, uint32_t *pte, void *arg)
+{
+  printf("%08ld: %08x\n", pgn * sizeof(uint32_t), *pte);
+}
+
 int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
 {
   int pgn_start,pgn_end;
-  int pgit;
 
   if(end == -1){
     pgn_start = 0;
@@ -353,10 +415,7 @@ int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
     printf("\n");
 
 
-  for(pgit = pgn_start; pgit < pgn_end; pgit++)
-  {
-     printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
-  }
+  pgtbl_walk(caller->mm, pgn_start, pgn_end, print_pte, NULL);
 
   return 0;
 }
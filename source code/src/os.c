@@ -4,9 +4,12 @@
 #include "sched.h"
 #include "loader.h"
 #include "mm.h"
+#include "stats.h"
+#include "ckpt.h"
 #include <semaphore.h>
 
 #include <pthread.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -14,15 +17,23 @@
 
 static int time_slot;
 static int num_cpus;
+/* Instructions a CPU runs per time slot, between two barriers. The
+ * default 1 is the strict lock-step mode, with time_slot 1 and batch N
+ * a whole quantum of N instructions runs between barriers */
+static int batch = 1;
 static int done = 0;
 
 #ifdef CPU_TLB
 static int tlbsz;
+static struct memphy_struct tlb;
 #endif
 
 #ifdef MM_PAGING
 static int memramsz;
 static int memswpsz[PAGING_MAX_MMSWP];
+static struct memphy_struct mram;
+static struct memphy_struct mswp[PAGING_MAX_MMSWP];
+static struct memphy_struct * mswp_tab[PAGING_MAX_MMSWP];	// pcb_t.mswp
 
 struct mmpaging_ld_args {
 	/* A dispatched argument struct to compact many-fields passing to loader */
@@ -34,54 +45,82 @@ struct mmpaging_ld_args {
 };
 #endif
 
-static struct ld_args{
-	char ** path;
-	unsigned long * start_time;
-#ifdef MLQ_SCHED
-	unsigned long * prio;
-#endif
-} ld_processes;
-int num_processes;
+/*
+ *  Process lines "[start] [path] [prio]" are read from the configure
+ *  file as the loader gets to them, never all at once, so the source
+ *  may be a FIFO or stdin which keeps feeding arrivals.
+ */
+static struct {
+	FILE * file;
+	char * line;		// getline() buffer
+	size_t line_cap;
+	unsigned long limit;	// Processes in the header, 0 if open-ended
+	unsigned long count;	// Process lines read so far
+} ld_src;
+static int num_processes;
+
+/* "checkpoint" directive, see checkpoint() */
+static uint64_t ckpt_slot;
+static char * ckpt_path;
+static char * config_path;
 
 struct cpu_args {
 	struct timer_id_t * timer_id;
 	int id;
+	/* State of cpu_routine() between two slots, kept in checkpoints */
+	struct pcb_t * proc;
+	int time_left;
+	uint64_t busy;
 };
+static struct cpu_args * cpu_args;
+
+
+/* Undo load() and ld_prepare() once [proc] has finished: its frames go
+ * back to the memory devices, then every structure it owns is freed */
+static void release_proc(struct pcb_t * proc) {
+	int i;
 
+#ifdef MM_PAGING
+	free_pcb_memph(proc);
+	free_mm(proc->mm);
+#endif
+	for (i = 0; i < proc->page_table->size; i++)
+		free(proc->page_table->table[i].next_lv);
+	free(proc->page_table);
+	release_code(proc->code);
+	free(proc);
+}
 
 static void * cpu_routine(void * args) {
-	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
-	int id = ((struct cpu_args*)args)->id;
-	/* Check for new process in ready queue */
-	int time_left = 0;
-	struct pcb_t * proc = NULL;
+	struct cpu_args * self = (struct cpu_args*)args;
+	struct timer_id_t * timer_id = self->timer_id;
+	int id = self->id;
+	/* Check for new process in ready queue, a restored CPU goes on with
+	 * the process it was running */
+	int time_left = self->time_left;
+	uint64_t busy = self->busy;
+	struct pcb_t * proc = self->proc;
 	while (1) {
-		usleep(3);
 		/* Check the status of current process */
 		if (proc == NULL) {
 			/* No process is running, the we load new process from
 		 	* ready queue */
-		 	usleep(3);
-			proc = get_proc();
-			if (proc == NULL) {
-                           next_slot(timer_id);
-                           continue; /* First load failed. skip dummy load */
-                        }
+			proc = get_proc(id);
 		}else if (proc->pc == proc->code->size) {
 			/* The porcess has finish it job */
 			printf("\tCPU %d: Processed %2d has finished\n",
 				id ,proc->pid);
-			free(proc);
-			usleep(3);
-			proc = get_proc();
+			stats_exit(proc);
+			release_proc(proc);
+			proc = get_proc(id);
 			time_left = 0;
 		}else if (time_left == 0) {
 			/* The process has done its job in current time slot */
 			printf("\tCPU %d: Put process %2d to run queue\n",
 				id, proc->pid);
-			put_proc(proc);
-			usleep(20);
-			proc = get_proc();
+			stats_preempt(proc);
+			put_proc(id, proc);
+			proc = get_proc(id);
 		}
 		
 		/* Recheck process status after loading new process */
@@ -90,83 +129,543 @@ static void * cpu_routine(void * args) {
 			printf("\tCPU %d stopped\n", id);
 			break;
 		}else if (proc == NULL) {
-			/* There may be new processes to run in
-			 * next time slots, just skip current slot */
-			next_slot(timer_id);
+			/* There may be new processes to run in next time
+			 * slots. Let the timer tick without this CPU until
+			 * one is put to a run queue */
+			self->proc = NULL;
+			self->time_left = 0;
+			self->busy = busy;
+			sched_wait(timer_id);
 			continue;
 		}else if (time_left == 0) {
-			usleep(5);
 			printf("\tCPU %d: Dispatched process %2d\n",
 				id, proc->pid);
+			stats_dispatch(proc);
 			time_left = time_slot;
 		}
 		
-		/* Run current process */
-		run(proc);
+		/* Run current process, up to [batch] instructions in this
+		 * slot. Shared state is guarded by the scheduler and memory
+		 * locks, so any number can run between two barriers */
+		run_slice(proc, batch);
+		proc->run_time++;
+		busy++;
+#ifdef MLQ_SCHED
+		proc->slice++;
+#endif
 		time_left--;
+		self->proc = proc;
+		self->time_left = time_left;
+		self->busy = busy;
 		next_slot(timer_id);
 	}
+	/* Every slot up to now not spent running was spent idle */
+	stats_cpu(id, busy, current_time() > busy ? current_time() - busy : 0);
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
 
-static void * ld_routine(void * args) {
+/*
+ *  Processes are prepared ahead of their arrival by a small pool of
+ *  workers (read from ld_src, load() and the mm set up), at most
+ *  LD_LOOKAHEAD of them past the last one handed over. The timer-driven
+ *  loader thread then only hands ready PCBs to the scheduler at their
+ *  start time, so a slow parse or allocation does not hold back the
+ *  arrival timeline. Entries live in a ring of LD_LOOKAHEAD slots, the
+ *  memory used does not depend on the number of processes.
+ */
+#define LD_LOOKAHEAD	32
+
+#define LD_EMPTY	0	// Slot free
+#define LD_PARSED	1	// Line read, the process is being prepared
+#define LD_READY	2	// PCB prepared, NULL if load failed
+
+static int ld_workers = 2;
+
+struct ld_entry_t {
+	unsigned long start_time;
+	unsigned long prio;
+	int has_prio;
+	char * path;
+	struct pcb_t * proc;
+	int state;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_mutex_t src_lock;	// One worker reads ld_src at a time
+	pthread_cond_t ready_cond;	// An entry was parsed or prepared
+	pthread_cond_t space_cond;	// The loader handed one over
+	unsigned long next;		// Next process to read
+	unsigned long handed;		// Processes handed over so far
+	uint32_t avail_pid;		// PID of the next one handed over
+	int eof;			// ld_src has no more than [next]
+	struct ld_entry_t ring[LD_LOOKAHEAD];
 #ifdef MM_PAGING
-	struct memphy_struct* mram = ((struct mmpaging_ld_args *)args)->mram;
-	struct memphy_struct** mswp = ((struct mmpaging_ld_args *)args)->mswp;
-	struct memphy_struct* active_mswp = ((struct mmpaging_ld_args *)args)->active_mswp;
+	struct mmpaging_ld_args * mm_args;
+#endif
+} ld_pool;
+
+/* Read the next process line of ld_src into [e]. Return 0 at the end of
+ * the source or once the count announced in the header is reached */
+static int ld_read(struct ld_entry_t * e) {
+	static const char prefix[] = "input/proc/";
+	char * start, * name, * prio, * save;
+	ssize_t len;
+
+	while (ld_src.limit == 0 || ld_src.count < ld_src.limit) {
+		len = getline(&ld_src.line, &ld_src.line_cap, ld_src.file);
+		if (len < 0)
+			return 0;
+		start = strtok_r(ld_src.line, " \t\r\n", &save);
+		if (start == NULL)
+			continue;	/* Blank line */
+		name = strtok_r(NULL, " \t\r\n", &save);
+		prio = strtok_r(NULL, " \t\r\n", &save);
+		if (name == NULL) {
+			printf("Malformed process line in configure file\n");
+			continue;
+		}
+		ld_src.count++;
+		e->start_time = strtoul(start, NULL, 10);
+		/* Without a priority the one of the process file is used */
+		e->has_prio = prio != NULL;
+		e->prio = prio != NULL ? strtoul(prio, NULL, 10) : 0;
+		/* Absolute paths are taken as is */
+		if (name[0] == '/') {
+			e->path = strdup(name);
+		}else{
+			e->path = (char *)malloc(sizeof(prefix) + strlen(name));
+			if (e->path != NULL) {
+				strcpy(e->path, prefix);
+				strcat(e->path, name);
+			}
+		}
+		if (e->path == NULL) {
+			printf("Out of memory reading configure file\n");
+			return 0;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+static struct pcb_t * ld_prepare(struct ld_entry_t * e) {
+	struct pcb_t * proc = load(e->path);
+	if (proc == NULL) {
+		/* Reported by load() */
+		return NULL;
+	}
+	/* On failure run_slice() falls back to interpreting the text */
+	predecode(proc->code);
+	if (!e->has_prio)
+		e->prio = proc->priority;
+#ifdef MLQ_SCHED
+	proc->prio = e->prio;
+#endif
+#ifdef MM_PAGING
+	struct mmpaging_ld_args * args = ld_pool.mm_args;
+
+	proc->mm = calloc(1, sizeof(struct mm_struct));
+	init_mm(proc->mm, proc);
+	proc->mram = args->mram;
+	proc->mswp = args->mswp;
+	proc->active_mswp = args->active_mswp;
 #ifdef CPU_TLB
-	struct memphy_struct *tlb = ((struct mmpaging_ld_args*)args)->tlb;
+        proc->tlb = args->tlb;
+#endif
+	sem_init(&proc->mm->memlock, 0, 1);
 #endif
+	return proc;
+}
+
+static void * ld_worker(void * args) {
+	struct ld_entry_t * e;
+	int got;
+
+	for (;;) {
+		/* Lines are taken in order, reading may block on a FIFO */
+		pthread_mutex_lock(&ld_pool.src_lock);
+		pthread_mutex_lock(&ld_pool.lock);
+		while (!ld_pool.eof &&
+		       ld_pool.next >= ld_pool.handed + LD_LOOKAHEAD)
+			pthread_cond_wait(&ld_pool.space_cond, &ld_pool.lock);
+		if (ld_pool.eof) {
+			pthread_mutex_unlock(&ld_pool.lock);
+			pthread_mutex_unlock(&ld_pool.src_lock);
+			break;
+		}
+		e = &ld_pool.ring[ld_pool.next % LD_LOOKAHEAD];
+		pthread_mutex_unlock(&ld_pool.lock);
+
+		got = ld_read(e);
+
+		pthread_mutex_lock(&ld_pool.lock);
+		if (got) {
+			e->state = LD_PARSED;
+			ld_pool.next++;
+		}else{
+			ld_pool.eof = 1;
+		}
+		pthread_cond_broadcast(&ld_pool.ready_cond);
+		pthread_mutex_unlock(&ld_pool.lock);
+		pthread_mutex_unlock(&ld_pool.src_lock);
+		if (!got)
+			break;
+
+		struct pcb_t * proc = ld_prepare(e);
+
+		pthread_mutex_lock(&ld_pool.lock);
+		e->proc = proc;
+		e->state = LD_READY;
+		pthread_cond_broadcast(&ld_pool.ready_cond);
+		pthread_mutex_unlock(&ld_pool.lock);
+	}
+	return NULL;
+}
+
+static void * ld_routine(void * args) {
+#ifdef MM_PAGING
 	struct timer_id_t * timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
+	ld_pool.mm_args = (struct mmpaging_ld_args *)args;
 #else
 	struct timer_id_t * timer_id = (struct timer_id_t*)args;
 #endif
-	int i = 0;
+	pthread_t * workers;
+	struct ld_entry_t * e;
+	unsigned long i, start_time, prio;
+	char * path;
+	int w;
+
+	pthread_mutex_init(&ld_pool.lock, NULL);
+	pthread_mutex_init(&ld_pool.src_lock, NULL);
+	pthread_cond_init(&ld_pool.ready_cond, NULL);
+	pthread_cond_init(&ld_pool.space_cond, NULL);
+	workers = (pthread_t *)malloc(sizeof(pthread_t) * ld_workers);
+	for (w = 0; w < ld_workers; w++)
+		pthread_create(&workers[w], NULL, ld_worker, NULL);
+
 	printf("ld_routine\n");
-	while (i < num_processes) {
-		struct pcb_t * proc = load(ld_processes.path[i]);
-#ifdef MLQ_SCHED
-		proc->prio = ld_processes.prio[i];
-#endif
-		while (current_time() < ld_processes.start_time[i]) {
-			next_slot(timer_id);
+	for (i = ld_pool.handed; ; i++) {
+		e = &ld_pool.ring[i % LD_LOOKAHEAD];
+
+		/* Holding the slot, so time waits for the next line and
+		 * for a late worker */
+		pthread_mutex_lock(&ld_pool.lock);
+		while (e->state == LD_EMPTY &&
+		       !(ld_pool.eof && i >= ld_pool.next))
+			pthread_cond_wait(&ld_pool.ready_cond, &ld_pool.lock);
+		if (e->state == LD_EMPTY) {
+			pthread_mutex_unlock(&ld_pool.lock);
+			break;
 		}
-#ifdef MM_PAGING
-		proc->mm = malloc(sizeof(struct mm_struct));
-		init_mm(proc->mm, proc);
-		proc->mram = mram;
-		proc->mswp = mswp;
-		proc->active_mswp = active_mswp;
-#ifdef CPU_TLB
-        proc->tlb = tlb;
-#endif
-		sem_init(&proc->mm->memlock, 0, 1);
-#endif
+		start_time = e->start_time;
+		pthread_mutex_unlock(&ld_pool.lock);
+
+		sleep_until(timer_id, start_time);
+
+		pthread_mutex_lock(&ld_pool.lock);
+		while (e->state != LD_READY)
+			pthread_cond_wait(&ld_pool.ready_cond, &ld_pool.lock);
+		/* The slot is reused as soon as it is handed over */
+		struct pcb_t * proc = e->proc;
+		path = e->path;
+		prio = e->prio;
+		e->state = LD_EMPTY;
+		ld_pool.handed = i + 1;
+		pthread_cond_broadcast(&ld_pool.space_cond);
+		pthread_mutex_unlock(&ld_pool.lock);
+
+		if (proc == NULL) {
+			/* A description that cannot be read is reported by
+			 * load() and skipped, the run goes on with the others
+			 * rather than end on one bad line of a stream */
+			free(path);
+			continue;
+		}
+		/* PIDs follow the arrival order, not the order workers
+		 * happened to finish in */
+		proc->pid = ld_pool.avail_pid++;
 		printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
-			ld_processes.path[i], proc->pid, ld_processes.prio[i]);
+			path, proc->pid, prio);
+		stats_arrive(proc);
 		add_proc(proc);
-		free(ld_processes.path[i]);
-		i++;
+		free(path);
 		next_slot(timer_id);
 	}
-	free(ld_processes.path);
-	free(ld_processes.start_time);
+	for (w = 0; w < ld_workers; w++)
+		pthread_join(workers[w], NULL);
+	free(workers);
+	pthread_cond_destroy(&ld_pool.space_cond);
+	pthread_cond_destroy(&ld_pool.ready_cond);
+	pthread_mutex_destroy(&ld_pool.src_lock);
+	pthread_mutex_destroy(&ld_pool.lock);
+	free(ld_src.line);
+	if (ld_src.file != stdin)
+		fclose(ld_src.file);
 	done = 1;
+	sched_stop();
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
 
+/*
+ *  Checkpoint: a ckpt_header_t and the configure file path, then the
+ *  memory devices, the state of every CPU with the process it runs, the
+ *  run queues and the figures of the finished processes. Processes not
+ *  handed over yet are not kept, a restore reads the configure file
+ *  again and skips the [handed] lines already consumed.
+ */
+static void checkpoint(void) {
+	struct ckpt_header_t hdr;
+	FILE * f;
+	int i, running;
+
+	if ((f = fopen(ckpt_path, "wb")) == NULL) {
+		printf("Cannot create checkpoint at %s\n", ckpt_path);
+		return;
+	}
+	hdr.magic = CKPT_MAGIC;
+	hdr.version = CKPT_VERSION;
+	hdr.slot = current_time();
+	hdr.num_cpus = num_cpus;
+	hdr.avail_pid = ld_pool.avail_pid;
+	hdr.handed = ld_pool.handed;
+	ckpt_put(f, &hdr, sizeof(hdr));
+	ckpt_put_str(f, config_path);
+#ifdef MM_PAGING
+	ckpt_put_memphy(f, &mram);
+	for (i = 0; i < PAGING_MAX_MMSWP; i++)
+		ckpt_put_memphy(f, &mswp[i]);
+#ifdef CPU_TLB
+	ckpt_put_memphy(f, &tlb);
+#endif
+#endif
+	for (i = 0; i < num_cpus; i++) {
+		running = cpu_args[i].proc != NULL;
+		ckpt_put(f, &running, sizeof(running));
+		if (running)
+			ckpt_put_proc(f, cpu_args[i].proc);
+		ckpt_put(f, &cpu_args[i].time_left, sizeof(int));
+		ckpt_put(f, &cpu_args[i].busy, sizeof(uint64_t));
+	}
+	sched_save(f, ckpt_put_proc);
+	stats_save(f);
+#ifdef MM_PAGING
+	pgrepl_save(f);
+	swap_save(f);
+#endif
+	if (fclose(f) != 0) {
+		printf("Cannot write checkpoint at %s\n", ckpt_path);
+		return;
+	}
+	printf("\tCheckpoint written to %s\n", ckpt_path);
+}
+
+/* Read a process of a checkpoint and attach it to the memory devices */
+static struct pcb_t * restore_proc(FILE * f) {
+	struct pcb_t * proc = ckpt_get_proc(f);
+
+#ifdef MM_PAGING
+	proc->mram = &mram;
+	proc->mswp = mswp_tab;
+	proc->active_mswp = &mswp[0];
+#ifdef CPU_TLB
+	proc->tlb = &tlb;
+#endif
+	/* Its resident pages are owned by the new PCB */
+	pgrepl_attach(proc);
+#endif
+	return proc;
+}
+
+/* Put back everything checkpoint() wrote after the configure file path,
+ * once the devices and the scheduler are set up as in the first run */
+static void restore(FILE * f, struct ckpt_header_t * hdr) {
+	struct ld_entry_t e;
+	unsigned long i;
+	int c, running;
+
+	/* The loader goes on with the next process line */
+	for (i = 0; i < hdr->handed; i++) {
+		if (!ld_read(&e)) {
+			printf("Configure file has fewer processes than the checkpoint\n");
+			exit(1);
+		}
+		free(e.path);
+	}
+	ld_pool.next = ld_pool.handed = hdr->handed;
+	ld_pool.avail_pid = hdr->avail_pid;
+#ifdef MM_PAGING
+	ckpt_get_memphy(f, &mram);
+	for (i = 0; i < PAGING_MAX_MMSWP; i++)
+		ckpt_get_memphy(f, &mswp[i]);
+#ifdef CPU_TLB
+	ckpt_get_memphy(f, &tlb);
+#endif
+#endif
+	for (c = 0; c < num_cpus; c++) {
+		ckpt_get(f, &running, sizeof(running));
+		cpu_args[c].proc = running ? restore_proc(f) : NULL;
+		ckpt_get(f, &cpu_args[c].time_left, sizeof(int));
+		ckpt_get(f, &cpu_args[c].busy, sizeof(uint64_t));
+	}
+	sched_load(f, restore_proc);
+	stats_load(f);
+#ifdef MM_PAGING
+	pgrepl_load(f);
+	swap_load(f);
+#endif
+	timer_set(hdr->slot);
+	printf("Restored checkpoint of time slot %lu\n", (unsigned long)hdr->slot);
+}
+
+/*
+ *  Optional directives, one per line between the header lines and the
+ *  process list:
+ *        [key] [value]
+ *  e.g. "sched cfs", "batch 16", "loaders 4", "pgrepl clock",
+ *  "swap 1 4194304 2" to give MEMSWP 1 4MB at priority 2 (the size
+ *  overrides the header one, devices of the same priority are striped)
+ *  or "checkpoint 40 ckpt.bin" to save the whole simulator at slot 40
+ *  (see checkpoint()). A line starts
+ *  with a letter, which tells it apart from a process line starting with
+ *  its arrival time.
+ */
+static int cfg_sched(const char * value) {
+	return sched_set_policy(value);
+}
+
+#ifdef MM_PAGING
+static int cfg_pgrepl(const char * value) {
+	return pgrepl_set_policy(value);
+}
+
+static int cfg_swap(const char * value) {
+	long max = (long)PAGING_PAGESZ <<
+		(PAGING_PTE_SWPOFF_HIBIT - PAGING_PTE_SWPOFF_LOBIT + 1);
+	long size;
+	int dev, prio = 0, n;
+
+	n = sscanf(value, "%d %ld %d", &dev, &size, &prio);
+	if (n < 2 || dev < 0 || dev >= PAGING_MAX_MMSWP ||
+	    size < 0 || size > max)
+		return -1;
+	memswpsz[dev] = (int)size;
+	return swap_set_prio(dev, prio);
+}
+#endif
+
+static int cfg_loaders(const char * value) {
+	char * end;
+	long n = strtol(value, &end, 10);
+
+	if (*end != '\0' || n <= 0 || n > 64)
+		return -1;
+	ld_workers = (int)n;
+	return 0;
+}
+
+static int cfg_batch(const char * value) {
+	char * end;
+	long n = strtol(value, &end, 10);
+
+	if (*end != '\0' || n <= 0 || n > 1000000)
+		return -1;
+	batch = (int)n;
+	return 0;
+}
+
+static int cfg_checkpoint(const char * value) {
+	char * path;
+	unsigned long slot = strtoul(value, &path, 10);
+
+	/* The path is the rest of the line, of any length */
+	if (path == value || !isspace((unsigned char)*path))
+		return -1;
+	while (isspace((unsigned char)*path))
+		path++;
+	if (*path == '\0')
+		return -1;
+	ckpt_slot = slot;
+	free(ckpt_path);
+	ckpt_path = strdup(path);
+	return ckpt_path != NULL ? 0 : -1;
+}
+
+static const struct {
+	const char * key;
+	int (*handler)(const char * value);
+} cfg_directives[] = {
+	{"sched", cfg_sched},
+	{"batch", cfg_batch},
+	{"loaders", cfg_loaders},
+	{"checkpoint", cfg_checkpoint},
+#ifdef MM_PAGING
+	{"pgrepl", cfg_pgrepl},
+	{"swap", cfg_swap},
+#endif
+};
+
+static void read_directives(FILE * file) {
+	char * line = NULL, * key, * value, * end;
+	size_t line_cap = 0;
+	int c, i;
+
+	for (;;) {
+		/* Peek the first non-blank character of the next line */
+		do {
+			c = fgetc(file);
+		} while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+		if (c == EOF)
+			break;
+		ungetc(c, file);
+		if (!isalpha(c))
+			break;
+		/* Like the process lines, no length limit */
+		if (getline(&line, &line_cap, file) < 0)
+			break;
+		/* The key is the first word, the value runs to the end of
+		 * the line */
+		key = line;
+		value = key + strcspn(key, " \t\r\n");
+		if (*value != '\0')
+			*value++ = '\0';
+		value += strspn(value, " \t");
+		for (end = value + strlen(value);
+		     end > value && isspace((unsigned char)end[-1]); end--)
+			end[-1] = '\0';
+		for (i = 0; i < (int)(sizeof(cfg_directives) / sizeof(cfg_directives[0])); i++)
+			if (!strcmp(key, cfg_directives[i].key))
+				break;
+		if (i == (int)(sizeof(cfg_directives) / sizeof(cfg_directives[0]))) {
+			printf("Unknown directive '%s' in configure file\n", key);
+			exit(1);
+		}
+		if (*value == '\0' || cfg_directives[i].handler(value) < 0) {
+			printf("Invalid value for directive '%s'\n", key);
+			exit(1);
+		}
+	}
+	free(line);
+}
+
+/* Read the header and the directives of the configure file, "-" for
+ * stdin. The process lines are left to the loader, see ld_read().
+ * A process count of 0 in the header reads them up to the end of file */
 static void read_config(const char * path) {
 	FILE * file;
-	if ((file = fopen(path, "r")) == NULL) {
+	if (!strcmp(path, "-")) {
+		file = stdin;
+	}else if ((file = fopen(path, "r")) == NULL) {
 		printf("Cannot find configure file at %s\n", path);
 		exit(1);
 	}
-	fscanf(file, "%d %d %d\n", &time_slot, &num_cpus, &num_processes);
-	ld_processes.path = (char**)malloc(sizeof(char*) * num_processes);
-	ld_processes.start_time = (unsigned long*)
-		malloc(sizeof(unsigned long) * num_processes);
+	if (fscanf(file, "%d %d %d\n", &time_slot, &num_cpus, &num_processes) != 3 ||
+	    time_slot <= 0 || num_cpus <= 0 || num_processes < 0) {
+		printf("Malformed configure file header at %s\n", path);
+		exit(1);
+	}
 
 #ifdef CPU_TLB
 #ifdef CPUTLB_FIXED_TLBSZ
@@ -208,40 +707,59 @@ static void read_config(const char * path) {
 #endif
 #endif
 
-#ifdef MLQ_SCHED
-	ld_processes.prio = (unsigned long*)
-		malloc(sizeof(unsigned long) * num_processes);
-#endif
-	int i;
-	for (i = 0; i < num_processes; i++) {
-		ld_processes.path[i] = (char*)malloc(sizeof(char) * 100);
-		ld_processes.path[i][0] = '\0';
-		strcat(ld_processes.path[i], "input/proc/");
-		char proc[100];
-#ifdef MLQ_SCHED
-		fscanf(file, "%lu %s %lu\n", &ld_processes.start_time[i], proc, &ld_processes.prio[i]);
-#else
-		fscanf(file, "%lu %s\n", &ld_processes.start_time[i], proc);
-#endif
-		strcat(ld_processes.path[i], proc);
-	}
+	read_directives(file);
+
+	ld_src.file = file;
+	ld_src.limit = num_processes;
 }
 
 int main(int argc, char * argv[]) {
+	FILE * ckpt = NULL;
+	struct ckpt_header_t hdr;
+	char * path;
+
 	/* Read config */
-	if (argc != 2) {
-		printf("Usage: os [path to configure file]\n");
+	if (argc == 3 && !strcmp(argv[1], "-r")) {
+		/* Restore: the checkpoint names the configure file */
+		if ((ckpt = fopen(argv[2], "rb")) == NULL) {
+			printf("Cannot find checkpoint at %s\n", argv[2]);
+			return 1;
+		}
+		ckpt_get(ckpt, &hdr, sizeof(hdr));
+		if (hdr.magic != CKPT_MAGIC || hdr.version != CKPT_VERSION) {
+			printf("Not a checkpoint at %s\n", argv[2]);
+			return 1;
+		}
+		path = ckpt_get_str(ckpt);
+		if (!strcmp(path, "-")) {
+			printf("Cannot restore a run fed from stdin\n");
+			return 1;
+		}
+	}else if (argc == 2) {
+		/* Configure files are looked up in input/ unless the path
+		 * is absolute, "-" reads from stdin */
+		if (argv[1][0] == '/' || !strcmp(argv[1], "-")) {
+			path = strdup(argv[1]);
+		}else{
+			path = (char *)malloc(strlen("input/") + strlen(argv[1]) + 1);
+			strcpy(path, "input/");
+			strcat(path, argv[1]);
+		}
+	}else{
+		printf("Usage: os [path to configure file | -]\n"
+			"       os -r [path to checkpoint]\n");
 		return 1;
 	}
-	char path[100];
-	path[0] = '\0';
-	strcat(path, "input/");
-	strcat(path, argv[1]);
 	read_config(path);
+	config_path = path;
+	if (ckpt != NULL && hdr.num_cpus != (uint32_t)num_cpus) {
+		printf("Checkpoint taken with %u CPUs\n", hdr.num_cpus);
+		return 1;
+	}
 
 	pthread_t * cpu = (pthread_t*)malloc(num_cpus * sizeof(pthread_t));
 	struct cpu_args * args =
-		(struct cpu_args*)malloc(sizeof(struct cpu_args) * num_cpus);
+		(struct cpu_args*)calloc(num_cpus, sizeof(struct cpu_args));
 	pthread_t ld;
 	
 	/* Init timer */
@@ -250,11 +768,9 @@ int main(int argc, char * argv[]) {
 		args[i].timer_id = attach_event();
 		args[i].id = i;
 	}
+	cpu_args = args;
 	struct timer_id_t * ld_event = attach_event();
-	start_timer();
 #ifdef CPU_TLB
-	struct memphy_struct tlb;
-
 	init_tlbmemphy(&tlb, tlbsz);
 #endif
 
@@ -262,24 +778,29 @@ int main(int argc, char * argv[]) {
 	/* Init all MEMPHY include 1 MEMRAM and n of MEMSWP */
 	int rdmflag = 1; /* By default memphy is RANDOM ACCESS MEMORY */
 
-	struct memphy_struct mram;
-	struct memphy_struct mswp[PAGING_MAX_MMSWP];
-
-
 	/* Create MEM RAM */
 	init_memphy(&mram, memramsz, rdmflag);
 		sem_init(&mram.memphylock, 0, 1);
 	/* Create all MEM SWAP */ 
 	int sit;
-	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
 	       init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
+	       sem_init(&mswp[sit].memphylock, 0, 1);
+	       mswp_tab[sit] = &mswp[sit];
+	}
+	swap_init(mswp_tab, PAGING_MAX_MMSWP);
+	/* Page replacement tracks every frame of MEMRAM */
+	if (pgrepl_init(memramsz / PAGING_PAGESZ) != 0) {
+		printf("Cannot allocate the frame table\n");
+		return 1;
+	}
 
 	/* In Paging mode, it needs passing the system mem to each PCB through loader*/
 	struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
 
 	mm_ld_args->timer_id = ld_event;
 	mm_ld_args->mram = (struct memphy_struct *) &mram;
-	mm_ld_args->mswp = (struct memphy_struct**) &mswp;
+	mm_ld_args->mswp = mswp_tab;
 	mm_ld_args->active_mswp = (struct memphy_struct *) &mswp[0];
 #endif
 
@@ -293,7 +814,16 @@ int main(int argc, char * argv[]) {
 #endif
 
 	/* Init scheduler */
-	init_scheduler();
+	init_scheduler(num_cpus);
+	stats_init(num_cpus);
+	ld_pool.avail_pid = 1;
+	if (ckpt != NULL) {
+		restore(ckpt, &hdr);
+		fclose(ckpt);
+	}
+	start_timer();
+	if (ckpt_path != NULL)
+		timer_at(ckpt_slot, checkpoint);
 
 	/* Run CPU and loader */
 #ifdef MM_PAGING
@@ -314,6 +844,12 @@ int main(int argc, char * argv[]) {
 
 	/* Stop timer */
 	stop_timer();
+	finish_scheduler();
+	stats_report();
+#ifdef MM_PAGING
+	pgrepl_report();
+	swap_report();
+#endif
 	#ifdef CPU_TLB
     result_TLB();
 	#endif
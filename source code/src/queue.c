@@ -9,12 +9,36 @@ int empty(struct queue_t *q)
         return (q->size == 0);
 }
 
-void enqueue(struct queue_t *q, struct pcb_t *proc)
+/* Double the ring buffer and unwrap it so that the oldest process
+ * lands at index 0 */
+static int grow(struct queue_t *q)
 {
-        if (!q || !proc) return;
-        if (q->size >= MAX_QUEUE_SIZE) return;
-        q->proc[q->size] = proc;
+        int cap = (q->cap > 0) ? q->cap * 2 : QUEUE_INIT_SIZE;
+        struct pcb_t **proc = malloc(sizeof(struct pcb_t *) * cap);
+        int i;
+
+        if (proc == NULL)
+                return -1;
+        for (i = 0; i < q->size; i++)
+                proc[i] = q->proc[(q->head + i) % q->cap];
+        free(q->proc);
+        q->proc = proc;
+        q->head = 0;
+        q->cap = cap;
+        return 0;
+}
+
+int enqueue(struct queue_t *q, struct pcb_t *proc)
+{
+        if (!q || !proc) return -1;
+        if (q->size == q->cap && grow(q) < 0) {
+                printf("enqueue: out of memory, queue holds %d processes\n",
+                        q->size);
+                return -1;
+        }
+        q->proc[(q->head + q->size) % q->cap] = proc;
         q->size++;
+        return 0;
 }
 
 struct pcb_t *dequeue(struct queue_t *q)
@@ -25,14 +49,101 @@ struct pcb_t *dequeue(struct queue_t *q)
         if (q->size <= 0) return NULL;
         else
         {
-                struct pcb_t *temp = q->proc[0];
+                struct pcb_t *temp = q->proc[q->head];
 
-                for (int i = 1; i < q->size; i++)
-                {
-                        q->proc[i - 1] = q->proc[i];
-                }
-                q->proc[q->size - 1] = NULL;
+                q->proc[q->head] = NULL;
+                q->head = (q->head + 1) % q->cap;
                 q->size--;
                 return temp;
         }
-}
\ No newline at end of file
+}
+
+void free_queue(struct queue_t *q)
+{
+        free(q->proc);
+        q->proc = NULL;
+        q->head = q->size = q->cap = 0;
+}
+
+int mpmc_init(struct mpmc_queue_t *q, size_t cap)
+{
+        size_t size = 2, i;
+
+        while (size < cap)
+                size <<= 1;
+        q->cells = malloc(sizeof(struct mpmc_cell_t) * size);
+        if (q->cells == NULL)
+                return -1;
+        for (i = 0; i < size; i++)
+                q->cells[i].seq = i;
+        q->mask = size - 1;
+        q->enq_pos = q->deq_pos = 0;
+        return 0;
+}
+
+int mpmc_enqueue(struct mpmc_queue_t *q, struct pcb_t *proc)
+{
+        struct mpmc_cell_t *cell;
+        size_t pos = __atomic_load_n(&q->enq_pos, __ATOMIC_RELAXED);
+        size_t seq;
+        long diff;
+
+        for (;;) {
+                cell = &q->cells[pos & q->mask];
+                seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+                diff = (long)seq - (long)pos;
+                if (diff == 0) {
+                        /* Cell is free for this lap, try to claim it */
+                        if (__atomic_compare_exchange_n(&q->enq_pos, &pos,
+                                pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                                break;
+                } else if (diff < 0) {
+                        return -1; /* Full */
+                } else {
+                        pos = __atomic_load_n(&q->enq_pos, __ATOMIC_RELAXED);
+                }
+        }
+        cell->proc = proc;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        return 0;
+}
+
+struct pcb_t *mpmc_dequeue(struct mpmc_queue_t *q)
+{
+        struct mpmc_cell_t *cell;
+        struct pcb_t *proc;
+        size_t pos = __atomic_load_n(&q->deq_pos, __ATOMIC_RELAXED);
+        size_t seq;
+        long diff;
+
+        for (;;) {
+                cell = &q->cells[pos & q->mask];
+                seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+                diff = (long)seq - (long)(pos + 1);
+                if (diff == 0) {
+                        /* Cell holds a process for this lap, try to take it */
+                        if (__atomic_compare_exchange_n(&q->deq_pos, &pos,
+                                pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                                break;
+                } else if (diff < 0) {
+                        return NULL; /* Empty */
+                } else {
+                        pos = __atomic_load_n(&q->deq_pos, __ATOMIC_RELAXED);
+                }
+        }
+        proc = cell->proc;
+        __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+        return proc;
+}
+
+int mpmc_empty(struct mpmc_queue_t *q)
+{
+        return __atomic_load_n(&q->deq_pos, __ATOMIC_RELAXED) ==
+                __atomic_load_n(&q->enq_pos, __ATOMIC_RELAXED);
+}
+
+void mpmc_destroy(struct mpmc_queue_t *q)
+{
+        free(q->cells);
+        q->cells = NULL;
+}
@@ -1,130 +1,738 @@
 #include "queue.h"
 #include "sched.h"
+#include "timer.h"
+#include "ckpt.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
+#include <string.h>
 
 static struct queue_t ready_queue;
 static struct queue_t run_queue;
 static pthread_mutex_t queue_lock;
 
+/*
+ *  Idle CPUs sleep in sched_wait() instead of polling the run queues,
+ *  their timer events parked so that time goes on without them. The
+ *  producer of a process unparks a waiter before it returns, so the
+ *  woken CPU takes part in the current slot again and cannot fall
+ *  behind the timer. A waiter publishes itself in [nr_waiters] before
+ *  checking for work and a producer publishes the work before checking
+ *  [nr_waiters], so one of the two always sees the other.
+ */
+struct sched_waiter_t {
+	struct timer_id_t * timer_id;
+	pthread_cond_t cond;
+	int woken;
+	struct sched_waiter_t * next;
+};
+
+static pthread_mutex_t wait_lock;
+static struct sched_waiter_t * waiters;	// Stack of sleeping CPUs
+static int nr_waiters;
+static int sched_stopped;
+
+#ifndef MLQ_SCHED
+/*
+ *  Without MLQ every CPU shares one round-robin ready queue. It is the
+ *  lock-free [lf_ready_queue]; [ready_queue] only takes the overflow,
+ *  under queue_lock, once the ring is full so no process is dropped.
+ */
+#define SCHED_LF_QUEUE_SIZE	4096
+static struct mpmc_queue_t lf_ready_queue;
+#endif
+
 #ifdef MLQ_SCHED
-static struct queue_t mlq_ready_queue[MAX_PRIO];
+/*
+ *  Bitmap of the non-empty priority levels: bit [prio] is set iff
+ *  queue[prio] of the run queue holds at least one process. It is only
+ *  changed under the run queue lock, together with the queue it describes.
+ */
+#define MLQ_BITMAP_WORDS	((MAX_PRIO + 63) / 64)
+
+/* Weight of a process running at the default (middle) priority */
+#define CFS_NICE0_WEIGHT	1024
+
+/*
+ *  Run queue. There is a single one shared by every CPU, or one per
+ *  CPU when SCHED_PERCPU_RQ is enabled in os-cfg.h. Depending on the
+ *  policy it keeps the MLQ level queues or the CFS min-heap.
+ */
+struct sched_rq {
+	pthread_mutex_t lock;
+	/* SCHED_MLQ */
+	struct queue_t queue[MAX_PRIO];
+	uint64_t bitmap[MLQ_BITMAP_WORDS];
+	uint64_t budget[MLQ_BITMAP_WORDS];	/* Levels with budget left this round */
+	int touched[MAX_PRIO];		/* Levels which spent budget this round */
+	int nr_touched;
+	/* SCHED_CFS */
+	struct pcb_t ** cfs_heap;	/* Min-heap on (vruntime, pid) */
+	int cfs_cap;
+	uint64_t min_vruntime;		/* Monotonic floor of queued vruntimes */
+
+	int nr_ready;			/* Processes waiting in this run queue */
+	unsigned long steals;		/* Processes this CPU took from a peer */
+	unsigned long migrations;	/* Dispatches away from the last CPU */
+	unsigned long dispatched[MAX_PRIO];	/* Slots given to each level */
+};
+
+static struct sched_rq * sched_rqs;
+static int nr_rqs;
+static enum sched_policy_t sched_policy = SCHED_MLQ;
+
+static const char * policy_name[] = {
+	[SCHED_MLQ] = "mlq",
+	[SCHED_CFS] = "cfs",
+};
+
+/*
+ *  Load weight for each of 40 nice levels, every level is ~1.25 times
+ *  the next one so that one level apart means ~10% CPU share. [prio]
+ *  0 .. MAX_PRIO - 1 is spread evenly over it.
+ */
+static const uint32_t cfs_prio_to_weight[40] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	 9548,  7620,  6100,  4904,  3906,
+	 3121,  2501,  1991,  1586,  1277,
+	 1024,   820,   655,   526,   423,
+	  335,   272,   215,   172,   137,
+	  110,    87,    70,    56,    45,
+	   36,    29,    23,    18,    15,
+};
+
+static inline uint32_t cfs_weight(struct pcb_t * proc)
+{
+	uint32_t prio = proc->prio < MAX_PRIO ? proc->prio : MAX_PRIO - 1;
+
+	return cfs_prio_to_weight[prio * 40 / MAX_PRIO];
+}
+
+static inline void mlq_mark(struct sched_rq * rq, int prio)
+{
+	__atomic_fetch_or(&rq->bitmap[prio / 64],
+		(uint64_t)1 << (prio % 64), __ATOMIC_RELAXED);
+}
+
+static inline void mlq_clear(struct sched_rq * rq, int prio)
+{
+	__atomic_fetch_and(&rq->bitmap[prio / 64],
+		~((uint64_t)1 << (prio % 64)), __ATOMIC_RELAXED);
+}
+
+/* Find the highest ready priority (lowest prio value), -1 if none.
+ * Peers may call it without holding [rq->lock] as a hint only. */
+static inline int mlq_first_prio(struct sched_rq * rq)
+{
+	int w;
+	uint64_t word;
+
+	for (w = 0; w < MLQ_BITMAP_WORDS; w++) {
+		word = __atomic_load_n(&rq->bitmap[w], __ATOMIC_RELAXED);
+		if (word)
+			return w * 64 + __builtin_ctzll(word);
+	}
+	return -1;
+}
+
+/* Find the highest ready level with budget left, -1 if none.
+ * Caller holds [rq->lock] */
+static inline int mlq_first_budget(struct sched_rq * rq)
+{
+	int w;
+	uint64_t word;
+
+	for (w = 0; w < MLQ_BITMAP_WORDS; w++) {
+		word = rq->bitmap[w] & rq->budget[w];
+		if (word)
+			return w * 64 + __builtin_ctzll(word);
+	}
+	return -1;
+}
+
+/* Refill the budget of every level, only the levels which spent some
+ * are visited. Caller holds [rq->lock] */
+static void mlq_new_round(struct sched_rq * rq)
+{
+	int i, prio;
+
+	for (i = 0; i < rq->nr_touched; i++) {
+		prio = rq->touched[i];
+		rq->queue[prio].curr_slot = MAX_PRIO - prio;
+	}
+	rq->nr_touched = 0;
+	for (i = 0; i < MLQ_BITMAP_WORDS; i++)
+		rq->budget[i] = (MAX_PRIO - i * 64 >= 64) ? ~(uint64_t)0 :
+			((uint64_t)1 << (MAX_PRIO - i * 64)) - 1;
+}
+
+static void mlq_enqueue(struct sched_rq * rq, struct pcb_t * proc)
+{
+	enqueue(&rq->queue[proc->prio], proc);
+	mlq_mark(rq, proc->prio);
+}
+
+/*
+ *  Take the next process of [rq] following the MLQ round. Every level
+ *  has MAX_PRIO - prio dispatches per round, spent in priority order:
+ *  the highest ready level with budget left goes first. A level keeps
+ *  what is left of its budget while its processes run on other CPUs,
+ *  it is served again as soon as one of them is put back. Once no
+ *  ready level has budget left the round ends and every budget is
+ *  refilled. State: queue[prio].curr_slot = 0 .. MAX_PRIO - prio, bit
+ *  [prio] of [budget] set iff curr_slot > 0, always under [rq->lock].
+ */
+static struct pcb_t * mlq_dequeue(struct sched_rq * rq)
+{
+	struct pcb_t * proc;
+	struct queue_t * q;
+	int prio = mlq_first_budget(rq);
+
+	if (prio < 0) {
+		if (mlq_first_prio(rq) < 0)
+			return NULL;
+		mlq_new_round(rq);
+		prio = mlq_first_budget(rq);
+	}
+	q = &rq->queue[prio];
+	proc = dequeue(q);
+	if (q->curr_slot == MAX_PRIO - prio)
+		rq->touched[rq->nr_touched++] = prio;
+	if (--q->curr_slot == 0)
+		rq->budget[prio / 64] &= ~((uint64_t)1 << (prio % 64));
+	if (empty(q))
+		mlq_clear(rq, prio);
+	return proc;
+}
+
+static inline int cfs_before(struct pcb_t * a, struct pcb_t * b)
+{
+	return a->vruntime < b->vruntime ||
+		(a->vruntime == b->vruntime && a->pid < b->pid);
+}
+
+static void cfs_enqueue(struct sched_rq * rq, struct pcb_t * proc)
+{
+	struct pcb_t ** heap;
+	int i, parent;
+
+	if (rq->nr_ready == rq->cfs_cap) {
+		int cap = rq->cfs_cap ? rq->cfs_cap * 2 : QUEUE_INIT_SIZE;
+
+		heap = realloc(rq->cfs_heap, sizeof(struct pcb_t *) * cap);
+		if (heap == NULL) {
+			printf("cfs_enqueue: out of memory\n");
+			exit(1);
+		}
+		rq->cfs_heap = heap;
+		rq->cfs_cap = cap;
+	}
+	heap = rq->cfs_heap;
+	/* Sift up */
+	for (i = rq->nr_ready; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!cfs_before(proc, heap[parent]))
+			break;
+		heap[i] = heap[parent];
+	}
+	heap[i] = proc;
+}
+
+/* Take the process with the smallest virtual runtime */
+static struct pcb_t * cfs_dequeue(struct sched_rq * rq)
+{
+	struct pcb_t ** heap = rq->cfs_heap;
+	struct pcb_t * proc, * last;
+	int n = rq->nr_ready - 1, i = 0, child;
+
+	if (rq->nr_ready == 0)
+		return NULL;
+	proc = heap[0];
+	last = heap[n];
+	/* Sift the last element down from the root */
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n && cfs_before(heap[child + 1], heap[child]))
+			child++;
+		if (!cfs_before(heap[child], last))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	if (proc->vruntime > rq->min_vruntime)
+		rq->min_vruntime = proc->vruntime;
+	return proc;
+}
+
+/* Caller holds [rq->lock] */
+static void rq_enqueue(struct sched_rq * rq, struct pcb_t * proc)
+{
+	if (sched_policy == SCHED_CFS)
+		cfs_enqueue(rq, proc);
+	else
+		mlq_enqueue(rq, proc);
+	__atomic_store_n(&rq->nr_ready, rq->nr_ready + 1, __ATOMIC_RELAXED);
+}
+
+/* Caller holds [rq->lock] */
+static struct pcb_t * rq_dequeue(struct sched_rq * rq)
+{
+	struct pcb_t * proc;
+
+	if (sched_policy == SCHED_CFS)
+		proc = cfs_dequeue(rq);
+	else
+		proc = mlq_dequeue(rq);
+	if (proc == NULL)
+		return NULL;
+	rq->dispatched[proc->prio]++;
+	__atomic_store_n(&rq->nr_ready, rq->nr_ready - 1, __ATOMIC_RELAXED);
+	return proc;
+}
+
+/* Take the best process of [rq] for another CPU: the head of its
+ * highest ready level, outside of the MLQ round so that the level
+ * budgets of [rq] are left alone, or its smallest virtual runtime.
+ * Caller holds [rq->lock] */
+static struct pcb_t * rq_steal(struct sched_rq * rq)
+{
+	struct pcb_t * proc = NULL;
+	int prio;
+
+	if (sched_policy == SCHED_CFS) {
+		proc = cfs_dequeue(rq);
+	} else if ((prio = mlq_first_prio(rq)) >= 0) {
+		proc = dequeue(&rq->queue[prio]);
+		if (empty(&rq->queue[prio]))
+			mlq_clear(rq, prio);
+	}
+	if (proc != NULL)
+		__atomic_store_n(&rq->nr_ready, rq->nr_ready - 1, __ATOMIC_RELAXED);
+	return proc;
+}
+
+/* Rank of the best work waiting in [rq] for stealing decisions, lower
+ * is better, -1 if none. CFS run queues are only ranked by length. */
+static inline int rq_top(struct sched_rq * rq)
+{
+	if (sched_policy == SCHED_CFS)
+		return __atomic_load_n(&rq->nr_ready, __ATOMIC_RELAXED) ? 0 : -1;
+	return mlq_first_prio(rq);
+}
+
+static struct sched_rq * cpu_rq(int cpu)
+{
+	return &sched_rqs[(cpu < 0 ? 0 : cpu) % nr_rqs];
+}
 #endif
 
-int queue_empty(void)
+int sched_set_policy(const char * name)
 {
 #ifdef MLQ_SCHED
-	unsigned long prio;
-	for (prio = 0; prio < MAX_PRIO; prio++)
-		if (!empty(&mlq_ready_queue[prio]))
-			return -1;
+	int i;
+
+	for (i = 0; i < (int)(sizeof(policy_name) / sizeof(policy_name[0])); i++)
+		if (!strcmp(name, policy_name[i])) {
+			sched_policy = (enum sched_policy_t)i;
+			return 0;
+		}
 #endif
-	return (empty(&ready_queue) && empty(&run_queue));
+	return -1;
+}
+
+/* Caller holds [wait_lock] */
+static void wake_waiter(struct sched_waiter_t * w)
+{
+	unpark_event(w->timer_id);
+	w->woken = 1;
+	pthread_cond_signal(&w->cond);
 }
 
-void init_scheduler(void)
+/* Wake up a CPU waiting for work, if any, after a process is queued */
+static void sched_wake(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&nr_waiters, __ATOMIC_RELAXED) == 0)
+		return;
+	pthread_mutex_lock(&wait_lock);
+	if (waiters != NULL) {
+		struct sched_waiter_t * w = waiters;
+
+		waiters = w->next;
+		wake_waiter(w);
+	}
+	pthread_mutex_unlock(&wait_lock);
+}
+
+int queue_empty(void)
 {
 #ifdef MLQ_SCHED
 	int i;
 
-	for (i = 0; i < MAX_PRIO; i++)
-		mlq_ready_queue[i].size = 0;
+	for (i = 0; i < nr_rqs; i++)
+		if (__atomic_load_n(&sched_rqs[i].nr_ready, __ATOMIC_RELAXED))
+			return 0;
+	return 1;
+#else
+	return (mpmc_empty(&lf_ready_queue) && empty(&ready_queue) &&
+		empty(&run_queue));
+#endif
+}
+
+void init_scheduler(int num_cpus)
+{
+#ifdef MLQ_SCHED
+	int i, prio;
+
+#ifdef SCHED_PERCPU_RQ
+	nr_rqs = (num_cpus > 0) ? num_cpus : 1;
+#else
+	nr_rqs = 1;
+#endif
+	sched_rqs = (struct sched_rq *)calloc(nr_rqs, sizeof(struct sched_rq));
+	for (i = 0; i < nr_rqs; i++) {
+		pthread_mutex_init(&sched_rqs[i].lock, NULL);
+		for (prio = 0; prio < MAX_PRIO; prio++)
+			sched_rqs[i].queue[prio].curr_slot = MAX_PRIO - prio;
+		mlq_new_round(&sched_rqs[i]);
+	}
+#else
+	mpmc_init(&lf_ready_queue, SCHED_LF_QUEUE_SIZE);
 #endif
 	ready_queue.size = 0;
 	run_queue.size = 0;
 	pthread_mutex_init(&queue_lock, NULL);
+	pthread_mutex_init(&wait_lock, NULL);
+	waiters = NULL;
+	nr_waiters = 0;
+	sched_stopped = 0;
+}
+
+void sched_wait(struct timer_id_t * timer_id)
+{
+	struct sched_waiter_t self;
+
+	self.timer_id = timer_id;
+	self.woken = 0;
+	pthread_cond_init(&self.cond, NULL);
+	pthread_mutex_lock(&wait_lock);
+	__atomic_fetch_add(&nr_waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!sched_stopped && queue_empty()) {
+		park_event(timer_id);
+		self.next = waiters;
+		waiters = &self;
+		while (!self.woken)
+			pthread_cond_wait(&self.cond, &wait_lock);
+	}
+	__atomic_fetch_sub(&nr_waiters, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&wait_lock);
+	pthread_cond_destroy(&self.cond);
+}
+
+void sched_stop(void)
+{
+	pthread_mutex_lock(&wait_lock);
+	sched_stopped = 1;
+	while (waiters != NULL) {
+		struct sched_waiter_t * w = waiters;
+
+		waiters = w->next;
+		wake_waiter(w);
+	}
+	pthread_mutex_unlock(&wait_lock);
 }
 
+void finish_scheduler(void)
+{
 #ifdef MLQ_SCHED
+	unsigned long steals = 0, migrations = 0, dispatched;
+	int i, prio;
+
+	for (i = 0; i < nr_rqs; i++) {
+		steals += sched_rqs[i].steals;
+		migrations += sched_rqs[i].migrations;
+	}
+	printf("Scheduler %s: %d run queue(s), %lu steal(s), %lu migration(s)\n",
+		policy_name[sched_policy], nr_rqs, steals, migrations);
+	for (prio = 0; prio < MAX_PRIO; prio++) {
+		dispatched = 0;
+		for (i = 0; i < nr_rqs; i++)
+			dispatched += sched_rqs[i].dispatched[prio];
+		if (!dispatched)
+			continue;
+		if (sched_policy == SCHED_CFS)
+			printf("\tPrio %3d: %lu dispatch(es), weight %u\n",
+				prio, dispatched,
+				cfs_prio_to_weight[prio * 40 / MAX_PRIO]);
+		else
+			printf("\tPrio %3d: %lu dispatch(es), budget %d per round\n",
+				prio, dispatched, MAX_PRIO - prio);
+	}
+	if (nr_rqs > 1) {
+		for (i = 0; i < nr_rqs; i++)
+			printf("\tCPU %d: %lu steal(s), %lu migration(s)\n",
+				i, sched_rqs[i].steals, sched_rqs[i].migrations);
+	}
+	for (i = 0; i < nr_rqs; i++) {
+		for (prio = 0; prio < MAX_PRIO; prio++)
+			free_queue(&sched_rqs[i].queue[prio]);
+		free(sched_rqs[i].cfs_heap);
+		pthread_mutex_destroy(&sched_rqs[i].lock);
+	}
+	free(sched_rqs);
+	sched_rqs = NULL;
+#else
+	mpmc_destroy(&lf_ready_queue);
+#endif
+	free_queue(&ready_queue);
+	free_queue(&run_queue);
+	pthread_mutex_destroy(&queue_lock);
+	pthread_mutex_destroy(&wait_lock);
+}
+
 /*
- *  Stateful design for routine calling
- *  based on the priority and our MLQ policy
- *  We implement stateful here using transition technique
- *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO - prio)
+ *  Checkpoints keep every run queue as it is, level queues in FIFO order
+ *  and the CFS heap in array order, so the restored run dispatches the
+ *  same processes in the same order. Nothing runs meanwhile (see
+ *  timer_at), the queues are read without their locks.
  */
-struct pcb_t * get_mlq_proc(void) {
-	int current_prio = 0; 
-	struct pcb_t * proc = NULL;
-	int next_prio = 0;
-
-	usleep(5);
-    if (mlq_ready_queue[current_prio].curr_slot > 0) {
-		if(!empty(&mlq_ready_queue[current_prio])){
-			pthread_mutex_lock(&queue_lock);
-        	proc = dequeue(&mlq_ready_queue[current_prio]);
-			mlq_ready_queue[current_prio].curr_slot--;
-			pthread_mutex_unlock(&queue_lock);
-		} else {
-			pthread_mutex_lock(&queue_lock);
-			next_prio = (current_prio + 1) % MAX_PRIO;
-			while (next_prio != current_prio) {
-				if (!empty(&mlq_ready_queue[next_prio])) {
-					proc = dequeue(&mlq_ready_queue[next_prio]);
-					mlq_ready_queue[next_prio].curr_slot--;
-					break;
-				} else {
-					next_prio = (next_prio + 1) % MAX_PRIO;
-				}
+void sched_save(FILE * f, void (*put)(FILE *, struct pcb_t *))
+{
+#ifdef MLQ_SCHED
+	uint32_t policy = sched_policy;
+	int i, prio, k, n;
+
+	ckpt_put(f, &policy, sizeof(policy));
+	ckpt_put(f, &nr_rqs, sizeof(nr_rqs));
+	for (i = 0; i < nr_rqs; i++) {
+		struct sched_rq * rq = &sched_rqs[i];
+
+		ckpt_put(f, &rq->min_vruntime, sizeof(rq->min_vruntime));
+		ckpt_put(f, &rq->steals, sizeof(rq->steals));
+		ckpt_put(f, &rq->migrations, sizeof(rq->migrations));
+		ckpt_put(f, rq->dispatched, sizeof(rq->dispatched));
+		for (prio = 0; prio < MAX_PRIO; prio++) {
+			struct queue_t * q = &rq->queue[prio];
+
+			ckpt_put(f, &q->curr_slot, sizeof(q->curr_slot));
+			ckpt_put(f, &q->size, sizeof(q->size));
+			for (k = 0; k < q->size; k++)
+				put(f, q->proc[(q->head + k) % q->cap]);
+		}
+		n = (sched_policy == SCHED_CFS) ? rq->nr_ready : 0;
+		ckpt_put(f, &n, sizeof(n));
+		for (k = 0; k < n; k++)
+			put(f, rq->cfs_heap[k]);
+	}
+#else
+	size_t pos;
+	int k, n;
+
+	n = (int)(lf_ready_queue.enq_pos - lf_ready_queue.deq_pos) +
+		ready_queue.size;
+	ckpt_put(f, &n, sizeof(n));
+	for (pos = lf_ready_queue.deq_pos; pos != lf_ready_queue.enq_pos; pos++)
+		put(f, lf_ready_queue.cells[pos & lf_ready_queue.mask].proc);
+	for (k = 0; k < ready_queue.size; k++)
+		put(f, ready_queue.proc[(ready_queue.head + k) % ready_queue.cap]);
+#endif
+}
+
+void sched_load(FILE * f, struct pcb_t * (*get)(FILE *))
+{
+#ifdef MLQ_SCHED
+	struct pcb_t ** heap;
+	uint32_t policy;
+	int i, prio, k, n;
+
+	ckpt_get(f, &policy, sizeof(policy));
+	ckpt_get(f, &n, sizeof(n));
+	if (policy != sched_policy || n != nr_rqs) {
+		printf("Checkpoint taken with another scheduler setup\n");
+		exit(1);
+	}
+	for (i = 0; i < nr_rqs; i++) {
+		struct sched_rq * rq = &sched_rqs[i];
+
+		ckpt_get(f, &rq->min_vruntime, sizeof(rq->min_vruntime));
+		ckpt_get(f, &rq->steals, sizeof(rq->steals));
+		ckpt_get(f, &rq->migrations, sizeof(rq->migrations));
+		ckpt_get(f, rq->dispatched, sizeof(rq->dispatched));
+		for (prio = 0; prio < MAX_PRIO; prio++) {
+			struct queue_t * q = &rq->queue[prio];
+
+			ckpt_get(f, &q->curr_slot, sizeof(q->curr_slot));
+			/* The round state follows from the budgets left */
+			if (q->curr_slot < MAX_PRIO - prio)
+				rq->touched[rq->nr_touched++] = prio;
+			if (q->curr_slot == 0)
+				rq->budget[prio / 64] &=
+					~((uint64_t)1 << (prio % 64));
+			ckpt_get(f, &n, sizeof(n));
+			for (k = 0; k < n; k++) {
+				enqueue(q, get(f));
+				mlq_mark(rq, prio);
+				rq->nr_ready++;
 			}
-			pthread_mutex_unlock(&queue_lock);
-			if (!proc && !empty(&mlq_ready_queue[current_prio])) {
-				pthread_mutex_lock(&queue_lock);
-				proc = dequeue(&mlq_ready_queue[current_prio]);
-				mlq_ready_queue[current_prio].curr_slot--;
-				pthread_mutex_unlock(&queue_lock);
+		}
+		ckpt_get(f, &n, sizeof(n));
+		if (n > 0) {
+			heap = realloc(rq->cfs_heap, sizeof(struct pcb_t *) * n);
+			if (heap == NULL) {
+				printf("Cannot restore run queue\n");
+				exit(1);
 			}
+			rq->cfs_heap = heap;
+			rq->cfs_cap = n;
+		}
+		/* Already a heap, kept in the same array order */
+		for (k = 0; k < n; k++)
+			rq->cfs_heap[rq->nr_ready++] = get(f);
+	}
+#else
+	int n;
+
+	ckpt_get(f, &n, sizeof(n));
+	while (n-- > 0)
+		add_proc(get(f));
+#endif
+}
+
+#ifdef MLQ_SCHED
+/*
+ *  Find the peer run queue worth stealing from: the one holding the
+ *  best ranked work (see rq_top), ties broken by the longest queue.
+ *  Only a peer strictly better than [best] qualifies, so an idle CPU
+ *  (best == -1) takes any work while a busy one only steals to keep
+ *  the MLQ order across CPUs. Lock-free hint, rechecked later.
+ */
+static struct sched_rq * find_busiest(struct sched_rq * self, int best)
+{
+	struct sched_rq * busiest = NULL;
+	int i, top, load, busiest_top = -1, busiest_load = 0;
+
+	for (i = 0; i < nr_rqs; i++) {
+		struct sched_rq * rq = &sched_rqs[i];
+
+		if (rq == self)
+			continue;
+		top = rq_top(rq);
+		if (top < 0)
+			continue;
+		if (best >= 0 && top >= best)
+			continue;
+		load = __atomic_load_n(&rq->nr_ready, __ATOMIC_RELAXED);
+		if (busiest == NULL || top < busiest_top ||
+		    (top == busiest_top && load > busiest_load)) {
+			busiest = rq;
+			busiest_top = top;
+			busiest_load = load;
 		}
-    } else {
-        mlq_ready_queue[current_prio].curr_slot = MAX_PRIO - current_prio;
-
-        next_prio = (current_prio + 1) % MAX_PRIO;
-        while (next_prio != current_prio) {
-            if (!empty(&mlq_ready_queue[next_prio])) {
-                pthread_mutex_lock(&queue_lock);
-                proc = dequeue(&mlq_ready_queue[next_prio]);
-                mlq_ready_queue[next_prio].curr_slot--;
-                pthread_mutex_unlock(&queue_lock);
-                current_prio = next_prio; 
-                break;
-            } else {
-                next_prio = (next_prio + 1) % MAX_PRIO;
-            }
-        }
-
-        if (!proc && !empty(&mlq_ready_queue[current_prio])) {
-			pthread_mutex_lock(&queue_lock);
-            proc = dequeue(&mlq_ready_queue[current_prio]);
-            mlq_ready_queue[current_prio].curr_slot--;
-			pthread_mutex_unlock(&queue_lock);
-        }
-    }
-	return proc;	
-}
-
-void put_mlq_proc(struct pcb_t *proc)
-{
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+	}
+	return busiest;
+}
+
+/* Processes ready on every run queue, lock-free hint */
+static int nr_ready_all(void) {
+	int i, n = 0;
+
+	for (i = 0; i < nr_rqs; i++)
+		n += __atomic_load_n(&sched_rqs[i].nr_ready, __ATOMIC_RELAXED);
+	return n;
+}
+
+/*
+ *  Pick the next process based on the active policy. MLQ finds ready
+ *  levels with a find-first-set over the run queue bitmap, so the cost
+ *  does not depend on MAX_PRIO or on how many processes are waiting,
+ *  and the round state persists in the run queue across calls (see
+ *  mlq_dequeue). CFS pops the smallest virtual runtime in O(log n).
+ *  With per-CPU run queues a CPU steals the best process of its busiest
+ *  peer, see rq_steal().
+ */
+struct pcb_t * get_mlq_proc(int cpu) {
+	struct sched_rq * rq = cpu_rq(cpu);
+	struct sched_rq * peer;
+	struct pcb_t * proc = NULL;
+	uint64_t peer_min = 0;
+
+	peer = (nr_rqs > 1) ? find_busiest(rq, rq_top(rq)) : NULL;
+	if (peer != NULL) {
+		pthread_mutex_lock(&peer->lock);
+		proc = rq_steal(peer);
+		peer_min = peer->min_vruntime;
+		pthread_mutex_unlock(&peer->lock);
+	}
+
+	pthread_mutex_lock(&rq->lock);
+	if (proc != NULL) {
+		rq->steals++;
+		rq->dispatched[proc->prio]++;
+		/* Carry the lag behind the peer's floor over to ours */
+		proc->vruntime = rq->min_vruntime +
+			(proc->vruntime > peer_min ? proc->vruntime - peer_min : 0);
+	} else {
+		proc = rq_dequeue(rq);
+	}
+	if (proc != NULL) {
+		if (proc->cpu >= 0 && proc->cpu != cpu)
+			rq->migrations++;
+		proc->cpu = cpu;
+		proc->slice = 0;
+	}
+	pthread_mutex_unlock(&rq->lock);
+	return proc;
+}
+
+void put_mlq_proc(int cpu, struct pcb_t *proc)
+{
+	struct sched_rq * rq = cpu_rq(cpu);
+
+	/* Charge the slots used since dispatch, scaled by the weight */
+	proc->vruntime += (uint64_t)proc->slice * CFS_NICE0_WEIGHT /
+		cfs_weight(proc);
+	proc->slice = 0;
+
+	pthread_mutex_lock(&rq->lock);
+	rq_enqueue(rq, proc);
+	pthread_mutex_unlock(&rq->lock);
+	/* The putting CPU takes a process right after, a waiter is only
+	 * worth waking if this one is not the only process ready */
+	if (nr_ready_all() > 1)
+		sched_wake();
 }
 
 void add_mlq_proc(struct pcb_t *proc)
 {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+	struct sched_rq * rq = &sched_rqs[0];
+	int i;
+
+	/* New arrivals go to the least loaded run queue */
+	for (i = 1; i < nr_rqs; i++)
+		if (__atomic_load_n(&sched_rqs[i].nr_ready, __ATOMIC_RELAXED) <
+		    __atomic_load_n(&rq->nr_ready, __ATOMIC_RELAXED))
+			rq = &sched_rqs[i];
+
+	proc->cpu = -1;
+	proc->slice = 0;
+	pthread_mutex_lock(&rq->lock);
+	/* Start level with the queued work instead of far behind it */
+	proc->vruntime = rq->min_vruntime;
+	rq_enqueue(rq, proc);
+	pthread_mutex_unlock(&rq->lock);
+	sched_wake();
 }
 
-struct pcb_t *get_proc(void)
+struct pcb_t *get_proc(int cpu)
 {
-	return get_mlq_proc();
+	return get_mlq_proc(cpu);
 }
 
-void put_proc(struct pcb_t *proc)
+void put_proc(int cpu, struct pcb_t *proc)
 {
-	return put_mlq_proc(proc);
+	return put_mlq_proc(cpu, proc);
 }
 
 void add_proc(struct pcb_t *proc)
@@ -132,26 +740,42 @@ void add_proc(struct pcb_t *proc)
 	return add_mlq_proc(proc);
 }
 #else
-struct pcb_t *get_proc(void)
+struct pcb_t *get_proc(int cpu)
 {
-	struct pcb_t *proc = NULL;
-	/*TODO: get a process from [ready_queue].
-	 * Remember to use lock to protect the queue.
-	 * */
+	struct pcb_t *proc = mpmc_dequeue(&lf_ready_queue);
+
+	if (proc == NULL && __atomic_load_n(&ready_queue.size, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&queue_lock);
+		proc = dequeue(&ready_queue);
+		pthread_mutex_unlock(&queue_lock);
+	}
 	return proc;
 }
 
-void put_proc(struct pcb_t *proc)
+static void ready_push(struct pcb_t *proc)
 {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&run_queue, proc);
-	pthread_mutex_unlock(&queue_lock);
+	if (mpmc_enqueue(&lf_ready_queue, proc) != 0) {
+		pthread_mutex_lock(&queue_lock);
+		enqueue(&ready_queue, proc);
+		pthread_mutex_unlock(&queue_lock);
+	}
+}
+
+void put_proc(int cpu, struct pcb_t *proc)
+{
+	int alone = mpmc_empty(&lf_ready_queue) &&
+		!__atomic_load_n(&ready_queue.size, __ATOMIC_RELAXED);
+
+	ready_push(proc);
+	/* The putting CPU takes a process right after, back to an empty
+	 * queue it takes this one and a waiter would find nothing */
+	if (!alone)
+		sched_wake();
 }
 
 void add_proc(struct pcb_t *proc)
 {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&ready_queue, proc);
-	pthread_mutex_unlock(&queue_lock);
+	ready_push(proc);
+	sched_wake();
 }
-#endif
\ No newline at end of file
+#endif
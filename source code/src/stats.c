@@ -0,0 +1,191 @@
+
+#include "stats.h"
+#include "timer.h"
+#include "ckpt.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Figures kept for a finished process, all times are in slots */
+struct proc_stat_t {
+	uint32_t pid;
+	uint32_t prio;
+	uint64_t arrival;
+	uint64_t response;	// First dispatch - arrival
+	uint64_t wait;		// Total time spent in run queues
+	uint64_t run;		// Total time spent on a CPU
+	uint64_t turnaround;	// Finish - arrival
+};
+
+struct cpu_stat_t {
+	uint64_t busy;
+	uint64_t idle;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct proc_stat_t * procs;
+static int nr_procs;
+static int procs_cap;
+static struct cpu_stat_t * cpus;
+static int nr_cpus;
+
+void stats_init(int num_cpus) {
+	nr_cpus = num_cpus;
+	cpus = (struct cpu_stat_t *)calloc(num_cpus, sizeof(struct cpu_stat_t));
+}
+
+void stats_arrive(struct pcb_t * proc) {
+	proc->arrival = current_time();
+	proc->ready_since = proc->arrival;
+	proc->first_dispatch = STATS_NEVER;
+	proc->finish = STATS_NEVER;
+	proc->wait_time = 0;
+	proc->run_time = 0;
+}
+
+void stats_dispatch(struct pcb_t * proc) {
+	uint64_t now = current_time();
+
+	if (proc->first_dispatch == STATS_NEVER)
+		proc->first_dispatch = now;
+	proc->wait_time += now - proc->ready_since;
+}
+
+void stats_preempt(struct pcb_t * proc) {
+	proc->ready_since = current_time();
+}
+
+void stats_exit(struct pcb_t * proc) {
+	struct proc_stat_t * st;
+
+	proc->finish = current_time();
+	pthread_mutex_lock(&stats_lock);
+	if (nr_procs == procs_cap) {
+		int cap = procs_cap ? procs_cap * 2 : 16;
+		st = realloc(procs, sizeof(struct proc_stat_t) * cap);
+		if (st == NULL) {
+			pthread_mutex_unlock(&stats_lock);
+			return;
+		}
+		procs = st;
+		procs_cap = cap;
+	}
+	st = &procs[nr_procs++];
+	st->pid = proc->pid;
+#ifdef MLQ_SCHED
+	st->prio = proc->prio;
+#else
+	st->prio = proc->priority;
+#endif
+	st->arrival = proc->arrival;
+	st->response = proc->first_dispatch - proc->arrival;
+	st->wait = proc->wait_time;
+	st->run = proc->run_time;
+	st->turnaround = proc->finish - proc->arrival;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_cpu(int cpu, uint64_t busy, uint64_t idle) {
+	if (cpu < 0 || cpu >= nr_cpus)
+		return;
+	cpus[cpu].busy = busy;
+	cpus[cpu].idle = idle;
+}
+
+void stats_save(FILE * f) {
+	ckpt_put(f, &nr_procs, sizeof(nr_procs));
+	ckpt_put(f, procs, sizeof(struct proc_stat_t) * nr_procs);
+}
+
+void stats_load(FILE * f) {
+	struct proc_stat_t * st;
+	int n;
+
+	ckpt_get(f, &n, sizeof(n));
+	if (n < 0) {
+		printf("Corrupted checkpoint\n");
+		exit(1);
+	}
+	st = realloc(procs, sizeof(struct proc_stat_t) * (n > 0 ? n : 1));
+	if (st == NULL) {
+		printf("Cannot restore statistics\n");
+		exit(1);
+	}
+	procs = st;
+	ckpt_get(f, procs, sizeof(struct proc_stat_t) * n);
+	procs_cap = n > 0 ? n : 1;
+	nr_procs = n;
+}
+
+static int cmp_u64(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Print the mean and the 99th percentile (nearest rank) of the field
+ * at [offset] in every proc_stat_t */
+static void print_summary(const char * name, size_t offset) {
+	uint64_t * val;
+	double sum = 0;
+	int i, rank;
+
+	val = (uint64_t *)malloc(sizeof(uint64_t) * nr_procs);
+	if (val == NULL)
+		return;
+	for (i = 0; i < nr_procs; i++) {
+		val[i] = *(uint64_t *)((char *)&procs[i] + offset);
+		sum += val[i];
+	}
+	qsort(val, nr_procs, sizeof(uint64_t), cmp_u64);
+	rank = (nr_procs * 99 + 99) / 100;
+	printf("\t%-10s: mean %8.2f  p99 %5lu  max %5lu\n", name,
+		sum / nr_procs, (unsigned long)val[rank - 1],
+		(unsigned long)val[nr_procs - 1]);
+	free(val);
+}
+
+void stats_report(void) {
+	uint64_t busy = 0, idle = 0, total;
+	int i;
+
+	printf("\nProcess statistics (in time slots):\n");
+	printf("\t PID PRIO  ARRIVAL RESPONSE     WAIT      RUN TURNAROUND\n");
+	for (i = 0; i < nr_procs; i++)
+		printf("\t%4u %4u %8lu %8lu %8lu %8lu %10lu\n",
+			procs[i].pid, procs[i].prio,
+			(unsigned long)procs[i].arrival,
+			(unsigned long)procs[i].response,
+			(unsigned long)procs[i].wait,
+			(unsigned long)procs[i].run,
+			(unsigned long)procs[i].turnaround);
+	if (nr_procs > 0) {
+		print_summary("Response",
+			offsetof(struct proc_stat_t, response));
+		print_summary("Wait", offsetof(struct proc_stat_t, wait));
+		print_summary("Turnaround",
+			offsetof(struct proc_stat_t, turnaround));
+	}
+
+	printf("CPU statistics (in time slots):\n");
+	for (i = 0; i < nr_cpus; i++) {
+		total = cpus[i].busy + cpus[i].idle;
+		printf("\tCPU %d: busy %6lu  idle %6lu  utilisation %5.1f%%\n",
+			i, (unsigned long)cpus[i].busy,
+			(unsigned long)cpus[i].idle,
+			total ? 100.0 * cpus[i].busy / total : 0.0);
+		busy += cpus[i].busy;
+		idle += cpus[i].idle;
+	}
+	total = busy + idle;
+	printf("\tAll  : busy %6lu  idle %6lu  utilisation %5.1f%%\n",
+		(unsigned long)busy, (unsigned long)idle,
+		total ? 100.0 * busy / total : 0.0);
+
+	free(procs);
+	procs = NULL;
+	nr_procs = procs_cap = 0;
+	free(cpus);
+	cpus = NULL;
+}
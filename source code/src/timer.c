@@ -2,9 +2,30 @@
 #include "timer.h"
 #include <stdio.h>
 #include <stdlib.h>
-
-static pthread_t _timer;
-
+#include <limits.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ *  Time slots are separated by a counting barrier instead of a timer
+ *  thread. Every device arrives once per slot in next_slot(); the last
+ *  of them to arrive (parked and finished devices do not count) moves
+ *  time forward and releases the others by bumping [slot_gen]. Waiters
+ *  sleep on [slot_gen] itself with a futex, so one slot costs a single
+ *  lock round trip per device plus one wake-all. All counters are
+ *  protected by [slot_lock].
+ *
+ *  A device may also sleep until a given slot (sleep_until). It counts
+ *  as done for every slot before that one. When a slot closes and no
+ *  device wants the next one, i.e. every live device is parked or
+ *  sleeping, time jumps straight to the earliest wake up. Only the
+ *  header of the slot landed on is printed, and of the timer_at() slot
+ *  if it is skipped over: a far arrival costs one line, not one per
+ *  slot. Once the last device is gone time stops where it is.
+ */
 struct timer_id_container_t {
 	struct timer_id_t id;
 	struct timer_id_container_t * next;
@@ -15,82 +36,182 @@ static struct timer_id_container_t * dev_list = NULL;
 static uint64_t _time;
 
 static int timer_started = 0;
-static int timer_stop = 0;
-
-
-static void * timer_routine(void * args) {
-	while (!timer_stop) {
-		if (current_time() != 0) printf("\n--------------------------------------------------------------\n\n");
-		printf("Time slot %3lu\n", current_time());
-		int fsh = 0;
-		int event = 0;
-		/* Wait for all devices have done the job in current
-		 * time slot */
-		struct timer_id_container_t * temp;
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
-			pthread_mutex_lock(&temp->id.event_lock);
-			while (!temp->id.done && !temp->id.fsh) {
-				pthread_cond_wait(
-					&temp->id.event_cond,
-					&temp->id.event_lock
-				);
-			}
-			if (temp->id.fsh) {
-				fsh++;
-			}
-			event++;
-			pthread_mutex_unlock(&temp->id.event_lock);
-		}
 
-		/* Increase the time slot */
-		_time++;
-		
-		/* Let devices continue their job */
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
-			pthread_mutex_lock(&temp->id.timer_lock);
-			temp->id.done = 0;
-			pthread_cond_signal(&temp->id.timer_cond);
-			pthread_mutex_unlock(&temp->id.timer_lock);
-		}
-		if (fsh == event) {
-			break;
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifndef __linux__
+static pthread_cond_t slot_cond = PTHREAD_COND_INITIALIZER;
+#endif
+static uint32_t slot_gen;	// Generation of the current slot
+static int nr_live;		// Devices attached and not detached
+static int nr_parked;		// Live devices which are parked
+static int nr_arrived;		// Live devices done with the current slot
+static int nr_sleeping;		// Live devices in sleep_until()
+static uint64_t next_wake = UINT64_MAX;	// Earliest wake_at of sleepers
+static uint64_t hook_slot = UINT64_MAX;	// See timer_at()
+static void (*hook_fn)(void);
+
+static void print_slot(void) {
+	if (_time != 0) printf("\n--------------------------------------------------------------\n\n");
+	printf("Time slot %3lu\n", (unsigned long)_time);
+}
+
+/* Caller holds [slot_lock]. Release the sleepers due at [_time] */
+static void wake_sleepers(void) {
+	struct timer_id_container_t * temp;
+
+	next_wake = UINT64_MAX;
+	for (temp = dev_list; temp != NULL; temp = temp->next) {
+		if (!temp->id.sleeping)
+			continue;
+		if (temp->id.wake_at <= _time) {
+			__atomic_store_n(&temp->id.sleeping, 0, __ATOMIC_RELEASE);
+			nr_sleeping--;
+#ifdef __linux__
+			syscall(SYS_futex, &temp->id.sleeping,
+				FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+		}else if (temp->id.wake_at < next_wake) {
+			next_wake = temp->id.wake_at;
 		}
 	}
-	pthread_exit(args);
+}
+
+/* Caller holds [slot_lock]. Close the current slot once every device
+ * not parked or sleeping has arrived. While every live device is parked
+ * nobody can make progress, the slot then stays open until one of them
+ * unparks and arrives */
+static void try_advance(void) {
+	uint64_t target;
+
+	if (!timer_started || nr_live == 0 ||
+	    nr_arrived + nr_parked + nr_sleeping < nr_live)
+		return;
+	if (nr_arrived == 0 && nr_sleeping == 0)
+		return;
+	/* Somebody wants the next slot, otherwise fast-forward */
+	target = nr_arrived > 0 ? _time + 1 : next_wake;
+	nr_arrived = 0;
+	/* Nobody runs until slot_gen moves, a safe point to look at the
+	 * whole simulator. The hook slot is landed on even when skipped */
+	if (hook_fn != NULL && hook_slot > _time && hook_slot < target) {
+		__atomic_store_n(&_time, hook_slot, __ATOMIC_RELAXED);
+		print_slot();
+		hook_fn();
+	}
+	__atomic_store_n(&_time, target, __ATOMIC_RELAXED);
+	print_slot();
+	if (_time == hook_slot && hook_fn != NULL)
+		hook_fn();
+	if (next_wake <= _time)
+		wake_sleepers();
+	__atomic_store_n(&slot_gen, slot_gen + 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+	syscall(SYS_futex, &slot_gen, FUTEX_WAKE_PRIVATE, INT_MAX,
+		NULL, NULL, 0);
+#else
+	pthread_cond_broadcast(&slot_cond);
+#endif
 }
 
 void next_slot(struct timer_id_t * timer_id) {
+	uint32_t gen;
+
 	/* Tell to timer that we have done our job in current slot */
-	pthread_mutex_lock(&timer_id->event_lock);
+	pthread_mutex_lock(&slot_lock);
+	gen = slot_gen;
 	timer_id->done = 1;
-	pthread_cond_signal(&timer_id->event_cond);
-	pthread_mutex_unlock(&timer_id->event_lock);
+	nr_arrived++;
+	try_advance();
 
 	/* Wait for going to next slot */
-	pthread_mutex_lock(&timer_id->timer_lock);
-	while (timer_id->done) {
-		pthread_cond_wait(
-			&timer_id->timer_cond,
-			&timer_id->timer_lock
-		);
+#ifdef __linux__
+	pthread_mutex_unlock(&slot_lock);
+	while (__atomic_load_n(&slot_gen, __ATOMIC_ACQUIRE) == gen)
+		syscall(SYS_futex, &slot_gen, FUTEX_WAIT_PRIVATE, gen,
+			NULL, NULL, 0);
+#else
+	while (slot_gen == gen)
+		pthread_cond_wait(&slot_cond, &slot_lock);
+	pthread_mutex_unlock(&slot_lock);
+#endif
+	timer_id->done = 0;
+}
+
+void sleep_until(struct timer_id_t * timer_id, uint64_t slot) {
+	if (slot <= current_time())
+		return;
+	if (slot == current_time() + 1) {
+		next_slot(timer_id);
+		return;
 	}
-	pthread_mutex_unlock(&timer_id->timer_lock);
+	pthread_mutex_lock(&slot_lock);
+	timer_id->wake_at = slot;
+	timer_id->sleeping = 1;
+	nr_sleeping++;
+	if (slot < next_wake)
+		next_wake = slot;
+	try_advance();
+
+	/* Released by wake_sleepers() once [slot] is reached, sleepers
+	 * wait on their own flag so that ticks before it do not wake them */
+#ifdef __linux__
+	pthread_mutex_unlock(&slot_lock);
+	while (__atomic_load_n(&timer_id->sleeping, __ATOMIC_ACQUIRE))
+		syscall(SYS_futex, &timer_id->sleeping, FUTEX_WAIT_PRIVATE, 1,
+			NULL, NULL, 0);
+#else
+	while (timer_id->sleeping)
+		pthread_cond_wait(&slot_cond, &slot_lock);
+	pthread_mutex_unlock(&slot_lock);
+#endif
 }
 
 uint64_t current_time() {
-	return _time;
+	return __atomic_load_n(&_time, __ATOMIC_RELAXED);
+}
+
+void timer_at(uint64_t slot, void (*fn)(void)) {
+	pthread_mutex_lock(&slot_lock);
+	hook_slot = slot;
+	hook_fn = fn;
+	pthread_mutex_unlock(&slot_lock);
+}
+
+void timer_set(uint64_t slot) {
+	if (!timer_started)
+		__atomic_store_n(&_time, slot, __ATOMIC_RELAXED);
 }
 
 void start_timer() {
+	pthread_mutex_lock(&slot_lock);
 	timer_started = 1;
-	pthread_create(&_timer, NULL, timer_routine, NULL);
+	print_slot();
+	pthread_mutex_unlock(&slot_lock);
 }
 
 void detach_event(struct timer_id_t * event) {
-	pthread_mutex_lock(&event->event_lock);
+	pthread_mutex_lock(&slot_lock);
 	event->fsh = 1;
-	pthread_cond_signal(&event->event_cond);
-	pthread_mutex_unlock(&event->event_lock);
+	if (event->parked)
+		nr_parked--;
+	nr_live--;
+	try_advance();
+	pthread_mutex_unlock(&slot_lock);
+}
+
+void park_event(struct timer_id_t * event) {
+	pthread_mutex_lock(&slot_lock);
+	event->parked = 1;
+	nr_parked++;
+	try_advance();
+	pthread_mutex_unlock(&slot_lock);
+}
+
+void unpark_event(struct timer_id_t * event) {
+	pthread_mutex_lock(&slot_lock);
+	event->parked = 0;
+	nr_parked--;
+	pthread_mutex_unlock(&slot_lock);
 }
 
 struct timer_id_t * attach_event() {
@@ -99,39 +220,24 @@ struct timer_id_t * attach_event() {
 	}else{
 		struct timer_id_container_t * container =
 			(struct timer_id_container_t*)malloc(
-				sizeof(struct timer_id_container_t)		
+				sizeof(struct timer_id_container_t)
 			);
 		container->id.done = 0;
 		container->id.fsh = 0;
-		pthread_cond_init(&container->id.event_cond, NULL);
-		pthread_mutex_init(&container->id.event_lock, NULL);
-		pthread_cond_init(&container->id.timer_cond, NULL);
-		pthread_mutex_init(&container->id.timer_lock, NULL);
-		if (dev_list == NULL) {
-			dev_list = container;
-			dev_list->next = NULL;
-		}else{
-			container->next = dev_list;
-			dev_list = container;
-		}
+		container->id.parked = 0;
+		container->id.sleeping = 0;
+		container->id.wake_at = 0;
+		container->next = dev_list;
+		dev_list = container;
+		nr_live++;
 		return &(container->id);
 	}
 }
 
 void stop_timer() {
-	timer_stop = 1;
-	pthread_join(_timer, NULL);
 	while (dev_list != NULL) {
 		struct timer_id_container_t * temp = dev_list;
 		dev_list = dev_list->next;
-		pthread_cond_destroy(&temp->id.event_cond);
-		pthread_mutex_destroy(&temp->id.event_lock);
-		pthread_cond_destroy(&temp->id.timer_cond);
-		pthread_mutex_destroy(&temp->id.timer_lock);
 		free(temp);
 	}
 }
-
-
-
-